@@ -1,13 +1,23 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-#define FIB_DEV "/dev/fibonacci"
+#include "fibdrv.h"
+
 #define BUFFSIZE 2500
 #define FIBSIZE 256
+#define RANGESIZE 65536
+#define BENCHSIZE (1 << 17)
+#define RINGSIZE 256
 
 /**
  * fib_to_string() - Convert the k-th Fibonacci number into string.
@@ -46,10 +56,529 @@ int fib_to_string(char *buf, int buf_sz, const unsigned int *fib, int fib_sz)
     return (buf[offset] == '\0') ? (offset - 1) : offset;
 }
 
-int main()
+static void print_fib(int i, const unsigned int *fib, int sz)
 {
-    char buf[FIBSIZE];
     char str_buf[BUFFSIZE];
+    int __offset = fib_to_string(str_buf, BUFFSIZE, fib, sz);
+    printf("Reading from " FIB_DEV
+           " at offset %d, returned the sequence "
+           "%s.\n",
+           i, str_buf + __offset);
+}
+
+/* fetch F(0)..F(N) through FIB_IOC_RANGE, several values per call */
+static void read_range(int fd, int N)
+{
+    static unsigned int buf[RANGESIZE / sizeof(unsigned int)];
+    struct fib_range req = {
+        .first = 0,
+        .last = N,
+        .buf = (unsigned long) buf,
+        .size = sizeof(buf),
+    };
+
+    while (req.first <= req.last) {
+        if (ioctl(fd, FIB_IOC_RANGE, &req) < 0) {
+            perror("FIB_IOC_RANGE");
+            return;
+        }
+
+        const unsigned int *frame = buf;
+        for (unsigned long long i = 0; i < req.count; i++) {
+            print_fib(req.first + i, frame + 1, frame[0]);
+            frame += frame[0] + 1;
+        }
+        req.first += req.count;
+    }
+}
+
+/*
+ * evaluate a(k) of the recurrence with coefficients coef and initial terms
+ * init, both comma-separated lists of the same length, as decimal digits
+ */
+static int read_recurrence(int fd,
+                           unsigned long long k,
+                           const char *coef,
+                           const char *init,
+                           char *buf,
+                           size_t size)
+{
+    struct fib_recurrence req = {
+        .format = FIB_FMT_DECIMAL,
+        .k = k,
+        .buf = (unsigned long) buf,
+        .size = size - 1,
+    };
+
+    char *c = (char *) coef, *i = (char *) init;
+    while (*c && req.order < FIB_REC_MAX_ORDER) {
+        req.coef[req.order] = strtoul(c, &c, 0);
+        req.init[req.order++] = strtoul(i, &i, 0);
+        c += *c == ',';
+        i += *i == ',';
+    }
+
+    int len = ioctl(fd, FIB_IOC_RECURRENCE, &req);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+/* F(0)..F(N) as decimal digits straight from read() */
+static void read_decimal(int fd, int N)
+{
+    char str[BUFFSIZE];
+    uint32_t format = FIB_FMT_DECIMAL;
+    if (ioctl(fd, FIB_IOC_SET_FORMAT, &format) < 0) {
+        perror("FIB_IOC_SET_FORMAT");
+        return;
+    }
+
+    for (int i = 0; i <= N; i++) {
+        lseek(fd, i, SEEK_SET);
+        ssize_t len = read(fd, str, sizeof(str) - 1);
+        if (len < 0) {
+            printf("Error reading from " FIB_DEV " at offset %d.\n", i);
+            continue;
+        }
+        str[len] = '\0';
+        printf("Reading from " FIB_DEV
+               " at offset %d, returned the sequence %s.\n",
+               i, str);
+    }
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* binary cells to decimal by repeated division by 10^9, destroys cells */
+static size_t cells_to_decimal(char *str, unsigned int *cells, int n)
+{
+    size_t len = 0;
+
+    while (n > 0 && !cells[n - 1])
+        n--;
+    do {
+        uint64_t rem = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            uint64_t cur = rem << 32 | cells[i];
+            cells[i] = cur / 1000000000;
+            rem = cur % 1000000000;
+        }
+        while (n > 0 && !cells[n - 1])
+            n--;
+        for (int j = 0; j < 9 && (n || rem); j++, rem /= 10)
+            str[len++] = '0' + rem % 10;
+    } while (n);
+    if (!len)
+        str[len++] = '0';
+
+    for (size_t i = 0; i < len / 2; i++) {
+        char c = str[i];
+        str[i] = str[len - 1 - i];
+        str[len - 1 - i] = c;
+    }
+    return len;
+}
+
+/*
+ * time F(k) in decimal three ways: read() in FIB_FMT_DECIMAL, read() in
+ * binary plus conversion here, and FIB_IOC_RECURRENCE converting in the
+ * kernel; all three must agree
+ */
+static void bench_decimal(int fd, unsigned long long k, int runs)
+{
+    char *str[3];
+    size_t len[3] = {0};
+    double us[3] = {0};
+    unsigned int *cells = malloc(BENCHSIZE);
+    for (int m = 0; m < 3; m++)
+        str[m] = malloc(BENCHSIZE);
+
+    for (int r = 0; r < runs; r++) {
+        uint32_t format = FIB_FMT_DECIMAL;
+        ioctl(fd, FIB_IOC_SET_FORMAT, &format);
+        lseek(fd, k, SEEK_SET);
+        double t0 = now_us();
+        ssize_t n = read(fd, str[0], BENCHSIZE);
+        double t1 = now_us();
+        len[0] = n < 0 ? 0 : n;
+
+        format = FIB_FMT_BINARY;
+        ioctl(fd, FIB_IOC_SET_FORMAT, &format);
+        n = read(fd, cells, BENCHSIZE);
+        len[1] = n < 0 ? 0 : cells_to_decimal(str[1], cells, n);
+        double t2 = now_us();
+
+        n = read_recurrence(fd, k, "1,1", "0,1", str[2], BENCHSIZE);
+        double t3 = now_us();
+        len[2] = n < 0 ? 0 : n;
+
+        us[0] += t1 - t0;
+        us[1] += t2 - t1;
+        us[2] += t3 - t2;
+    }
+
+    static const char *const name[] = {
+        "decimal read()",
+        "binary read() + user conversion",
+        "FIB_IOC_RECURRENCE (kernel conversion)",
+    };
+    printf("F(%llu), %zu digits, average of %d runs\n", k, len[0], runs);
+    for (int m = 0; m < 3; m++)
+        printf("  %-40s %10.1f us%s\n", name[m], us[m] / runs,
+               len[m] == len[0] && !memcmp(str[m], str[0], len[0])
+                   ? ""
+                   : "  MISMATCH");
+
+    free(cells);
+    for (int m = 0; m < 3; m++)
+        free(str[m]);
+}
+
+/* print the first and the last count digits of F(k) */
+static int read_digits(int fd, unsigned long long k, int count)
+{
+    struct fib_digits lead = {
+        .k = k,
+        .which = FIB_DIGITS_LEADING,
+        .count = count,
+    };
+    struct fib_digits trail = {
+        .k = k,
+        .which = FIB_DIGITS_TRAILING,
+        .count = count,
+    };
+
+    if (ioctl(fd, FIB_IOC_DIGITS, &lead) < 0 ||
+        ioctl(fd, FIB_IOC_DIGITS, &trail) < 0)
+        return -1;
+    printf("F(%llu) has %llu digits: %.*s...%.*s\n", k,
+           (unsigned long long) lead.length, (int) lead.count, lead.digits,
+           (int) trail.count, trail.digits);
+    return 0;
+}
+
+/* the rings of FIB_IOC_RING_SETUP as mapped into this process */
+struct ring {
+    struct fib_ring_params p;
+    struct fib_ring *idx;
+    struct fib_sqe *sq;
+    struct fib_cqe *cq;
+    char *data;
+};
+
+/* set up entries submission and completion slots of FIBSIZE bytes each */
+static int ring_setup(int fd, struct ring *r, unsigned int entries)
+{
+    memset(r, 0, sizeof(*r));
+    r->p.sq_entries = r->p.cq_entries = entries;
+    r->p.data_size = entries * FIBSIZE;
+    if (ioctl(fd, FIB_IOC_RING_SETUP, &r->p) < 0)
+        return -1;
+
+    char *mem = mmap(NULL, r->p.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    if (mem == MAP_FAILED)
+        return -1;
+    r->idx = (struct fib_ring *) mem;
+    r->sq = (struct fib_sqe *) (mem + r->p.sq_off);
+    r->cq = (struct fib_cqe *) (mem + r->p.cq_off);
+    r->data = mem + r->p.data_off;
+    return 0;
+}
+
+/*
+ * post F(first)..F(first + n - 1), n at most the ring size, ring the
+ * doorbell once and call done() for every completion in order
+ */
+static int ring_batch(int fd,
+                      struct ring *r,
+                      unsigned long long first,
+                      unsigned int n,
+                      void (*done)(const struct fib_cqe *, const void *))
+{
+    unsigned int tail = r->idx->sq_tail, mask = r->p.sq_entries - 1;
+    for (unsigned int i = 0; i < n; i++) {
+        struct fib_sqe *sqe = &r->sq[(tail + i) & mask];
+        sqe->k = first + i;
+        sqe->user_data = i;
+        sqe->offset = i * FIBSIZE;
+        sqe->size = FIBSIZE;
+    }
+    __atomic_store_n(&r->idx->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    for (unsigned int reaped = 0; reaped < n;) {
+        if (ioctl(fd, FIB_IOC_RING_ENTER) < 0)
+            return -1;
+        unsigned int head = r->idx->cq_head;
+        unsigned int cq_tail =
+            __atomic_load_n(&r->idx->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++, reaped++) {
+            const struct fib_cqe *cqe = &r->cq[head & (r->p.cq_entries - 1)];
+            done(cqe, r->data + cqe->user_data * FIBSIZE);
+        }
+        __atomic_store_n(&r->idx->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void ring_print(const struct fib_cqe *cqe, const void *cells)
+{
+    if (cqe->status)
+        printf("Error reading from " FIB_DEV " at offset %llu.\n",
+               (unsigned long long) cqe->k);
+    else
+        print_fib(cqe->k, cells, cqe->size);
+}
+
+/* F(0)..F(N) through the shared rings */
+static void read_ring(int fd, int N)
+{
+    struct ring r;
+    if (ring_setup(fd, &r, RINGSIZE) < 0) {
+        perror("FIB_IOC_RING_SETUP");
+        return;
+    }
+    for (int i = 0; i <= N; i += RINGSIZE) {
+        if (ring_batch(fd, &r, i, N + 1 - i < RINGSIZE ? N + 1 - i : RINGSIZE,
+                       ring_print) < 0) {
+            perror("FIB_IOC_RING_ENTER");
+            return;
+        }
+    }
+}
+
+static unsigned long long ring_sum;
+
+static void ring_add(const struct fib_cqe *cqe, const void *cells)
+{
+    for (unsigned int i = 0; !cqe->status && i < cqe->size; i++)
+        ring_sum += ((const unsigned int *) cells)[i];
+}
+
+/*
+ * look up count values of F(0)..F(92), which fit 64 bits, through
+ * lseek() + read() and through the rings, and compare the rates
+ */
+static void bench_ring(int fd, int count)
+{
+    unsigned int cells[FIBSIZE / sizeof(unsigned int)];
+    unsigned long long sum = 0;
+    struct ring r;
+    if (ring_setup(fd, &r, RINGSIZE) < 0) {
+        perror("FIB_IOC_RING_SETUP");
+        return;
+    }
+
+    double t0 = now_us();
+    for (int i = 0; i < count; i++) {
+        lseek(fd, i % 93, SEEK_SET);
+        ssize_t n = read(fd, cells, sizeof(cells));
+        for (ssize_t j = 0; j < n; j++)
+            sum += cells[j];
+    }
+    double t1 = now_us();
+
+    // batches of 93 keep every batch at the same indices
+    ring_sum = 0;
+    for (int i = 0; i < count; i += 93) {
+        if (ring_batch(fd, &r, 0, count - i < 93 ? count - i : 93, ring_add) <
+            0) {
+            perror("FIB_IOC_RING_ENTER");
+            return;
+        }
+    }
+    double t2 = now_us();
+
+    printf("%d lookups of F(0)..F(92)\n", count);
+    printf("  %-24s %12.0f values/s\n", "lseek() + read()",
+           count / (t1 - t0) * 1e6);
+    printf("  %-24s %12.0f values/s%s\n", "rings", count / (t2 - t1) * 1e6,
+           ring_sum == sum ? "" : "  MISMATCH");
+}
+
+/* bit-at-a-time Fibonacci coding, to compare FIB_IOC_ZECK_* against */
+static uint64_t zeck_fib[94];
+
+static uint64_t zeck_encode(unsigned char *codes, const uint64_t *v, int n)
+{
+    uint64_t bit = 0;
+    for (int i = 0; i < n; i++) {
+        int k = 2;
+        while (k < 93 && zeck_fib[k + 1] <= v[i])
+            k++;
+        // the terminating 1, then the representation from the top down
+        int len = k;
+        codes[(bit + len - 1) / 8] |= 1 << (bit + len - 1) % 8;
+        for (uint64_t x = v[i]; k >= 2; k--) {
+            if (zeck_fib[k] <= x) {
+                codes[(bit + k - 2) / 8] |= 1 << (bit + k - 2) % 8;
+                x -= zeck_fib[k];
+            }
+        }
+        bit += len;
+    }
+    return bit;
+}
+
+static int zeck_decode(uint64_t *v, const unsigned char *codes, uint64_t bits)
+{
+    int n = 0, pos = 0, prev = 0;
+    uint64_t x = 0;
+    for (uint64_t bit = 0; bit < bits; bit++) {
+        int b = codes[bit / 8] >> bit % 8 & 1;
+        if (b && prev) {
+            v[n++] = x;
+            x = pos = prev = 0;
+            continue;
+        }
+        if (b)
+            x += zeck_fib[pos + 2];
+        prev = b;
+        pos++;
+    }
+    return n;
+}
+
+/* code count values of mixed sizes in user space and in the driver */
+static void bench_zeck(int fd, int count)
+{
+    size_t size = (size_t) count * 12 + 8;
+    uint64_t *v = malloc(count * sizeof(uint64_t));
+    uint64_t *out = malloc(count * sizeof(uint64_t));
+    unsigned char *ref = calloc(size, 1), *codes = calloc(size, 1);
+    if (!v || !out || !ref || !codes) {
+        perror("malloc");
+        goto out;
+    }
+
+    zeck_fib[1] = 1;
+    for (int k = 2; k < 94; k++)
+        zeck_fib[k] = zeck_fib[k - 1] + zeck_fib[k - 2];
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        uint64_t r = (uint64_t) rand() << 33 ^ (uint64_t) rand() << 2 ^ rand();
+        v[i] = (r >> rand() % 64) + 1;
+    }
+
+    double t0 = now_us();
+    uint64_t bits = zeck_encode(ref, v, count);
+    double t1 = now_us();
+    int n = zeck_decode(out, ref, bits);
+    double t2 = now_us();
+    int ok = n == count && !memcmp(out, v, count * sizeof(uint64_t));
+
+    struct fib_zeck z = {
+        .values = (uintptr_t) v,
+        .codes = (uintptr_t) codes,
+        .count = count,
+        .end = size * 8,
+    };
+    if (ioctl(fd, FIB_IOC_ZECK_ENCODE, &z) < 0) {
+        perror("FIB_IOC_ZECK_ENCODE");
+        goto out;
+    }
+    double t3 = now_us();
+    ok = ok && z.count == count && z.end == bits &&
+         !memcmp(codes, ref, (bits + 7) / 8);
+
+    memset(out, 0, count * sizeof(uint64_t));
+    z.values = (uintptr_t) out;
+    if (ioctl(fd, FIB_IOC_ZECK_DECODE, &z) < 0) {
+        perror("FIB_IOC_ZECK_DECODE");
+        goto out;
+    }
+    double t4 = now_us();
+    ok = ok && z.count == count && z.end == bits &&
+         !memcmp(out, v, count * sizeof(uint64_t));
+
+    printf("%d values, %.2f bits per value\n", count, (double) bits / count);
+    printf("  %-24s %12.0f values/s\n", "encode, user space",
+           count / (t1 - t0) * 1e6);
+    printf("  %-24s %12.0f values/s\n", "decode, user space",
+           count / (t2 - t1) * 1e6);
+    printf("  %-24s %12.0f values/s\n", "FIB_IOC_ZECK_ENCODE",
+           count / (t3 - t2) * 1e6);
+    printf("  %-24s %12.0f values/s%s\n", "FIB_IOC_ZECK_DECODE",
+           count / (t4 - t3) * 1e6, ok ? "" : "  MISMATCH");
+out:
+    free(v);
+    free(out);
+    free(ref);
+    free(codes);
+}
+
+/* submit F(0)..F(N) at once, then collect the results as they complete */
+static void read_async(int fd, int N)
+{
+    static char frame[sizeof(struct fib_result) + FIBSIZE];
+    unsigned int(*fib)[FIBSIZE / sizeof(unsigned int)] =
+        calloc(N + 1, sizeof(*fib));
+    int *fib_sz = calloc(N + 1, sizeof(int));
+    uint64_t *index = malloc((N + 1) * sizeof(uint64_t));
+    if (!fib || !fib_sz || !index) {
+        perror("calloc");
+        goto out;
+    }
+
+    for (int i = 0; i <= N; i++)
+        index[i] = i;
+    // the driver takes MAX_INFLIGHT indices at a time and write() fails
+    // with EAGAIN beyond that, so results are reaped while submitting
+    struct pollfd pfd = {.fd = fd};
+    for (int submitted = 0, completed = 0; completed <= N;) {
+        if (submitted <= N) {
+            ssize_t n = write(fd, index + submitted,
+                              (N + 1 - submitted) * sizeof(uint64_t));
+            if (n < 0 && errno != EAGAIN) {
+                perror("write");
+                goto out;
+            }
+            if (n > 0)
+                submitted += n / sizeof(uint64_t);
+        }
+
+        pfd.events = POLLIN | (submitted <= N ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            perror("poll");
+            goto out;
+        }
+        if (!(pfd.revents & POLLIN))
+            continue;
+        if (read(fd, frame, sizeof(frame)) < 0) {
+            perror("read");
+            goto out;
+        }
+
+        struct fib_result *res = (struct fib_result *) frame;
+        if (res->status) {
+            printf("Error reading from " FIB_DEV " at offset %llu.\n",
+                   (unsigned long long) res->k);
+        } else {
+            memcpy(fib[res->k], res + 1, res->size * sizeof(unsigned int));
+            fib_sz[res->k] = res->size;
+        }
+        completed++;
+    }
+
+    for (int i = 0; i <= N; i++)
+        if (fib_sz[i])
+            print_fib(i, fib[i], fib_sz[i]);
+out:
+    free(fib);
+    free(fib_sz);
+    free(index);
+}
+
+int main(int argc, char *argv[])
+{
+    char buf[FIBSIZE];
     int N = 300; /* TODO: try test something bigger than the limit */
 
     int fd = open(FIB_DEV, O_RDWR);
@@ -58,18 +587,82 @@ int main()
         exit(1);
     }
 
+    if (argc > 1 && !strcmp(argv[1], "--range")) {
+        read_range(fd, N);
+        close(fd);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--async")) {
+        read_async(fd, N);
+        close(fd);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--recurrence")) {
+        static char str[RANGESIZE];
+        if (argc > 4) {  // --recurrence k coef init, e.g. 10 1,1 2,1
+            if (read_recurrence(fd, strtoull(argv[2], NULL, 0), argv[3],
+                                argv[4], str, sizeof(str)) < 0)
+                perror("FIB_IOC_RECURRENCE");
+            else
+                printf("%s\n", str);
+            close(fd);
+            return 0;
+        }
+
+        // F(0)..F(N) as the recurrence a(n) = a(n - 1) + a(n - 2)
+        for (int i = 0; i <= N; i++) {
+            if (read_recurrence(fd, i, "1,1", "0,1", str, sizeof(str)) < 0)
+                printf("Error reading from " FIB_DEV " at offset %d.\n", i);
+            else
+                printf("Reading from " FIB_DEV
+                       " at offset %d, returned the sequence %s.\n",
+                       i, str);
+        }
+        close(fd);
+        return 0;
+    }
+
+    if (argc > 1 && !strcmp(argv[1], "--decimal")) {
+        read_decimal(fd, N);
+        close(fd);
+        return 0;
+    }
+    if (argc > 2 && !strcmp(argv[1], "--bench-decimal")) {  // k [runs]
+        bench_decimal(fd, strtoull(argv[2], NULL, 0),
+                      argc > 3 ? atoi(argv[3]) : 10);
+        close(fd);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--ring")) {
+        read_ring(fd, N);
+        close(fd);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--bench-ring")) {  // [count]
+        bench_ring(fd, argc > 2 ? atoi(argv[2]) : 1000000);
+        close(fd);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--bench-zeck")) {  // [count]
+        bench_zeck(fd, argc > 2 ? atoi(argv[2]) : 1000000);
+        close(fd);
+        return 0;
+    }
+    if (argc > 2 && !strcmp(argv[1], "--digits")) {  // --digits k [count]
+        int count = argc > 3 ? atoi(argv[3]) : 20;
+        if (read_digits(fd, strtoull(argv[2], NULL, 0), count) < 0)
+            perror("FIB_IOC_DIGITS");
+        close(fd);
+        return 0;
+    }
+
     for (int i = 0; i <= N; i++) {
         lseek(fd, i, SEEK_SET);
         long long sz = read(fd, buf, FIBSIZE);
         if (sz < 0) {
             printf("Error reading from " FIB_DEV " at offset %d.\n", i);
         } else {
-            int __offset =
-                fib_to_string(str_buf, BUFFSIZE, (unsigned int *) buf, sz);
-            printf("Reading from " FIB_DEV
-                   " at offset %d, returned the sequence "
-                   "%s.\n",
-                   i, str_buf + __offset);
+            print_fib(i, (unsigned int *) buf, sz);
         }
     }
 
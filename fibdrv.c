@@ -1,13 +1,37 @@
+#include <linux/atomic.h>
+#include <linux/cache.h>
 #include <linux/cdev.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/fs.h>
+#include <linux/hashtable.h>
 #include <linux/init.h>
 #include <linux/kdev_t.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/kref.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "fibdrv.h"
+#include "lib/decimal.h"
+#include "lib/digits.h"
+#include "lib/limbs.h"
+#include "lib/recurrence.h"
+#include "lib/zeckendorf.h"
 
 /**
  * Only include one calculation method at a time.
@@ -15,11 +39,13 @@
  * Method 2: Introduce fast-doubling.
  * Method 3: Optimize multiplication using Schonhange Strassen.
  * Method 4: Optimize multiplication using Karatsuba.
+ * Method 5: Optimize multiplication using Toom-Cook 3-way.
  */
 // #include "lib/adding.h"
 // #include "lib/fast_doubling.h"
 // #include "lib/schonhange_strassen.h"
-#include "lib/karatsuba.h"
+// #include "lib/karatsuba.h"
+#include "lib/toom_cook.h"
 
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_AUTHOR("National Cheng Kung University, Taiwan");
@@ -29,57 +55,1385 @@ MODULE_VERSION("0.1");
 #define MAX_LENGTH 188795
 #define DEV_FIBONACCI_NAME "fibonacci"
 #define BUFFSIZE 2500
+#define MAX_INFLIGHT 256
+#define FIB_RA_MAX 16
+#define FIB_ZECK_CHUNK 4096
 
 static dev_t fib_dev = 0;
 static struct class *fib_class;
-static DEFINE_MUTEX(fib_mutex);
 static int major = 0, minor = 0;
+static struct workqueue_struct *fib_wq;
+static struct workqueue_struct *fib_ra_wq;
+static struct workqueue_struct *fib_flight_wq;
+
+static unsigned int budget_ms;
+module_param(budget_ms, uint, 0644);
+MODULE_PARM_DESC(budget_ms,
+                 "Default compute-time budget per request in ms (0 = none)");
+
+// read-only, they decide the scratch size of computations in flight
+static unsigned int karatsuba_threshold;
+module_param(karatsuba_threshold, uint, 0444);
+MODULE_PARM_DESC(karatsuba_threshold,
+                 "Operand limbs from which Karatsuba is used (0 = measure)");
+
+static unsigned int toom3_threshold;
+module_param(toom3_threshold, uint, 0444);
+MODULE_PARM_DESC(toom3_threshold,
+                 "Operand limbs from which Toom-3 is used (0 = measure)");
+
+static unsigned int readahead = 4;
+module_param(readahead, uint, 0644);
+MODULE_PARM_DESC(readahead,
+                 "Results prefetched ahead of strided reads (0 = off, max 16)");
+
+// prefetched results read() consumed or dropped unread, write 0 to reset
+static atomic_long_t ra_useful, ra_wasted;
+
+static int fib_counter_set(const char *val, const struct kernel_param *kp)
+{
+    long v;
+    int rc = kstrtol(val, 0, &v);
+    if (!rc)
+        atomic_long_set(kp->arg, v);
+    return rc;
+}
+
+static int fib_counter_get(char *buf, const struct kernel_param *kp)
+{
+    return sprintf(buf, "%ld\n", atomic_long_read(kp->arg));
+}
+
+static const struct kernel_param_ops fib_counter_ops = {
+    .set = fib_counter_set,
+    .get = fib_counter_get,
+};
+
+module_param_cb(readahead_useful, &fib_counter_ops, &ra_useful, 0644);
+MODULE_PARM_DESC(readahead_useful, "Prefetched results served by read()");
+module_param_cb(readahead_wasted, &fib_counter_ops, &ra_wasted, 0644);
+MODULE_PARM_DESC(readahead_wasted, "Prefetched results dropped unread");
+
+static unsigned int coalesce_min = 10000;
+module_param(coalesce_min, uint, 0644);
+MODULE_PARM_DESC(coalesce_min,
+                 "Smallest index whose concurrent read()s share one "
+                 "computation");
+
+// read()s that joined a computation another caller had started
+static atomic_long_t flights_joined;
+module_param_cb(coalesced, &fib_counter_ops, &flights_joined, 0644);
+MODULE_PARM_DESC(coalesced, "Reads served by a computation already running");
+
+/**
+ * struct fib_flight - A computation of F(k) shared by concurrent read()s.
+ * @node:      Entry in fib_flights until it completes or nobody waits.
+ * @work:      Runs the computation on fib_flight_wq.
+ * @k:         Index being computed.
+ * @format:    FIB_FMT_BINARY or FIB_FMT_DECIMAL, what @data holds.
+ * @users:     Callers waiting, protected by fib_flight_lock.
+ * @ref:       Held by every user and by the computation.
+ * @cancel:    Set once @users drops to zero, aborts the computation.
+ * @done:      Completed once @err, @data and @len are valid.
+ * @err:       Zero or the negative errno of the computation.
+ * @data:      What read() returns: cells, or decimal digits.
+ * @len:       Bytes in @data.
+ */
+struct fib_flight {
+    struct hlist_node node;
+    struct work_struct work;
+    long long k;
+    unsigned int format;
+    unsigned int users;
+    struct kref ref;
+    bool cancel;
+    struct completion done;
+    int err;
+    void *data;
+    size_t len;
+};
+
+static DEFINE_HASHTABLE(fib_flights, 6);
+static DEFINE_SPINLOCK(fib_flight_lock);
+
+/**
+ * struct fib_rings - Rings shared with user space, see FIB_IOC_RING_SETUP.
+ * @mem:     Area from vmalloc_user() mapped by user space, starting with a
+ *           struct fib_ring.
+ * @p:       Geometry and offsets within @mem.
+ * @sq_head: The driver's copy of the index in @mem, which user space can
+ *           overwrite.
+ * @cq_tail: Likewise.
+ * @lock:    Serializes FIB_IOC_RING_ENTER.
+ */
+struct fib_rings {
+    void *mem;
+    struct fib_ring_params p;
+    u32 sq_head;
+    u32 cq_tail;
+    struct mutex lock;
+};
+
+/**
+ * struct fib_file - Per open file state.
+ * @lock:      Protects @done, @pending, @closed, @ra, @rings and the read
+ *             pattern.
+ * @done:      Completed asynchronous requests, in completion order.
+ * @pending:   Number of submitted requests still being computed.
+ * @ndone:     Number of requests on @done, computed but not read yet.
+ * @closed:    Set on release; aborts computations and drops their results.
+ * @wait:      Woken whenever a request completes.
+ * @ref:       Held by the file and by every outstanding request.
+ * @budget_ms: Compute-time budget of each request, 0 for no limit.
+ * @format:    FIB_FMT_BINARY or FIB_FMT_DECIMAL, what read() returns.
+ * @ra:        Prefetched results for read(), finished or still computing.
+ * @ra_count:  Number of requests on @ra.
+ * @last_k:    Index of the previous synchronous read().
+ * @stride:    Distance between the last two synchronous read()s.
+ * @streak:    Number of read()s in a row that moved by @stride again.
+ * @rings:     Shared rings, NULL until FIB_IOC_RING_SETUP.
+ */
+struct fib_file {
+    spinlock_t lock;
+    struct list_head done;
+    unsigned int pending;
+    unsigned int ndone;
+    bool closed;
+    wait_queue_head_t wait;
+    struct kref ref;
+    unsigned int budget_ms;
+    unsigned int format;
+    struct list_head ra;
+    unsigned int ra_count;
+    long long last_k;
+    long long stride;
+    unsigned int streak;
+    struct fib_rings *rings;
+};
+
+struct fib_request {
+    struct list_head list;
+    struct work_struct work;
+    struct fib_file *owner;
+    long long k;
+    unsigned int budget_ms;
+    int status;
+    ubig *fib;
+    bool ready;   // prefetch finished, @status and @fib are valid
+    bool cancel;  // prefetch no longer wanted, its worker frees it
+};
+
+static void fib_file_free(struct kref *ref)
+{
+    kfree(container_of(ref, struct fib_file, ref));
+}
+
+static void fib_request_free(struct fib_request *req)
+{
+    destroy_ubig(req->fib);
+    kfree(req);
+}
+
+static void fib_rings_free(struct fib_rings *rings)
+{
+    vfree(rings->mem);
+    mutex_destroy(&rings->lock);
+    kfree(rings);
+}
 
 static int fib_open(struct inode *inode, struct file *file)
 {
-    if (!mutex_trylock(&fib_mutex)) {
-        printk(KERN_ALERT "fibdrv is in use\n");
-        return -EBUSY;
-    }
+    struct fib_file *ff = kzalloc(sizeof(*ff), GFP_KERNEL);
+    if (!ff)
+        return -ENOMEM;
+    spin_lock_init(&ff->lock);
+    INIT_LIST_HEAD(&ff->done);
+    INIT_LIST_HEAD(&ff->ra);
+    init_waitqueue_head(&ff->wait);
+    kref_init(&ff->ref);
+    ff->budget_ms = READ_ONCE(budget_ms);
+    file->private_data = ff;
     return 0;
 }
 
+/*
+ * give up a prefetch already taken off ff->ra, called with ff->lock held;
+ * a finished one moves to freed, a running one is freed by its worker
+ */
+static void fib_ra_drop(struct fib_request *req, struct list_head *freed)
+{
+    if (req->ready)
+        list_add(&req->list, freed);
+    else
+        WRITE_ONCE(req->cancel, true);
+}
+
+/* free the prefetches fib_ra_drop() collected, nobody read them */
+static void fib_ra_free(struct list_head *freed)
+{
+    struct fib_request *req, *tmp;
+
+    list_for_each_entry_safe (req, tmp, freed, list) {
+        atomic_long_inc(&ra_wasted);
+        fib_request_free(req);
+    }
+}
+
 static int fib_release(struct inode *inode, struct file *file)
 {
-    mutex_unlock(&fib_mutex);
+    struct fib_file *ff = file->private_data;
+    struct fib_request *req, *tmp;
+    LIST_HEAD(done);
+    LIST_HEAD(freed);
+
+    // requests still running are freed by their workers
+    spin_lock(&ff->lock);
+    ff->closed = true;
+    list_splice_init(&ff->done, &done);
+    list_for_each_entry_safe (req, tmp, &ff->ra, list) {
+        list_del(&req->list);
+        fib_ra_drop(req, &freed);
+    }
+    ff->ra_count = 0;
+    spin_unlock(&ff->lock);
+
+    list_for_each_entry_safe (req, tmp, &done, list)
+        fib_request_free(req);
+    fib_ra_free(&freed);
+    // mappings hold the file, so none is left
+    if (ff->rings)
+        fib_rings_free(ff->rings);
+    kref_put(&ff->ref, fib_file_free);
     return 0;
 }
 
+/* number of cells actually holding data, at least one */
+static int fib_cells(const ubig *x)
+{
+    int n = x->size;
+    while (n > 1 && !x->cell[n - 1])
+        n--;
+    return n;
+}
+
+/**
+ * fib_sequence_ws() - Calculate F(k) in a workspace taken from the pool.
+ * @k:   Index of the Fibonacci number to calculate.
+ * @ctx: Initialized context, receives the workspace in @ctx->ws.
+ *
+ * Return: F(k), valid until fib_ws_put(@ctx->ws), or NULL on failure.
+ */
+static ubig *fib_sequence_ws(long long k, struct fib_ctx *ctx)
+{
+    ctx->ws = fib_ws_get(fib_ws_bytes(k));
+    if (!ctx->ws)
+        return NULL;
+
+    ubig *fib = fib_sequence(k, NULL, ctx);
+    if (!fib) {
+        fib_ws_put(ctx->ws);
+        ctx->ws = NULL;
+    }
+    return fib;
+}
+
+/* copy src into a new zeroed ubig of (possibly) larger size */
+static ubig *fib_ubig_sized(const ubig *src, int size)
+{
+    ubig *dest = new_ubig(size);
+    if (dest)
+        memcpy(dest->cell, src->cell,
+               min(src->size, size) * sizeof(unsigned int));
+    return dest;
+}
+
+/**
+ * fib_sequence_sized() - Calculate F(k) into a ubig of its own.
+ * @k:    Index of the Fibonacci number to calculate.
+ * @size: Cells of the result, and of *@next.
+ * @next: If not NULL, receives F(k + 1) from the same doubling run, to be
+ *        freed with destroy_ubig() as well.
+ * @ctx:  Initialized context.
+ *
+ * Return: F(k), or NULL with @ctx->err set.
+ */
+static ubig *fib_sequence_sized(long long k,
+                                int size,
+                                ubig **next,
+                                struct fib_ctx *ctx)
+{
+    ctx->ws = fib_ws_get(fib_ws_bytes(next ? k + 1 : k));
+    if (!ctx->ws)
+        return NULL;
+
+    ubig *fib1, *fib = fib_sequence(k, next ? &fib1 : NULL, ctx);
+    ubig *dest = NULL;
+    if (fib) {
+        dest = fib_ubig_sized(fib, size);
+        // ctx->err is still -ENOMEM after a successful fib_sequence()
+        if (dest && next && !(*next = fib_ubig_sized(fib1, size))) {
+            destroy_ubig(dest);
+            dest = NULL;
+        }
+    }
+    fib_ws_put(ctx->ws);
+    ctx->ws = NULL;
+    return dest;
+}
+
+/* F(k) as decimal digits in a workspace, valid until fib_ws_put(ctx->ws) */
+static char *fib_decimal_ws(long long k, size_t *len, struct fib_ctx *ctx)
+{
+    ctx->ws = fib_ws_get(dec_ws_bytes(k) +
+                         FIB_WS_ALIGN(dec_str_size(dec_size(k))));
+    if (!ctx->ws)
+        return NULL;
+
+    int n;
+    unsigned int *fib = dec_fib(k, &n, ctx);
+    if (!fib) {
+        fib_ws_put(ctx->ws);
+        ctx->ws = NULL;
+        return NULL;
+    }
+    char *str = fib_ws_alloc(ctx->ws, dec_str_size(n));
+    *len = dec_get_str(str, fib, n);
+    return str;
+}
+
+static void fib_flight_free(struct kref *ref)
+{
+    struct fib_flight *f = container_of(ref, struct fib_flight, ref);
+    kvfree(f->data);
+    kfree(f);
+}
+
+/* compute a flight into a buffer of its own, the workspace goes back */
+static void fib_flight_work(struct work_struct *work)
+{
+    struct fib_flight *f = container_of(work, struct fib_flight, work);
+    struct fib_ctx ctx;
+    const void *src = NULL;
+
+    // no deadline, every user waits within its own budget and the last
+    // one to give up cancels the computation
+    fib_ctx_init(&ctx, 0, &f->cancel);
+    if (f->format == FIB_FMT_DECIMAL) {
+        src = fib_decimal_ws(f->k, &f->len, &ctx);
+    } else {
+        ubig *fib = fib_sequence_ws(f->k, &ctx);
+        if (fib) {
+            src = fib->cell;
+            f->len = fib->size * sizeof(unsigned int);
+        }
+    }
+
+    if (src) {
+        f->data = kvmalloc(f->len, GFP_KERNEL);
+        if (f->data)
+            memcpy(f->data, src, f->len);
+        f->err = f->data ? 0 : -ENOMEM;
+        fib_ws_put(ctx.ws);
+    } else {
+        f->err = ctx.err;
+    }
+
+    // later callers start afresh rather than share a finished result
+    spin_lock(&fib_flight_lock);
+    hash_del(&f->node);
+    spin_unlock(&fib_flight_lock);
+    complete_all(&f->done);
+    kref_put(&f->ref, fib_flight_free);
+}
+
+/**
+ * fib_flight_join() - Share the computation of F(k) with concurrent callers.
+ * @k:      Index of the Fibonacci number.
+ * @format: FIB_FMT_BINARY or FIB_FMT_DECIMAL.
+ *
+ * Joins the computation of the same @k and @format if one is running,
+ * otherwise starts one on fib_flight_wq. Every successful call has to be
+ * paired with fib_flight_leave().
+ *
+ * Return: The shared computation, or NULL if out of memory.
+ */
+static struct fib_flight *fib_flight_join(long long k, unsigned int format)
+{
+    struct fib_flight *f, *new = kzalloc(sizeof(*new), GFP_KERNEL);
+    if (!new)
+        return NULL;
+
+    spin_lock(&fib_flight_lock);
+    hash_for_each_possible (fib_flights, f, node, k) {
+        if (f->k == k && f->format == format) {
+            f->users++;
+            kref_get(&f->ref);
+            spin_unlock(&fib_flight_lock);
+            kfree(new);
+            atomic_long_inc(&flights_joined);
+            return f;
+        }
+    }
+
+    INIT_WORK(&new->work, fib_flight_work);
+    new->k = k;
+    new->format = format;
+    new->users = 1;
+    kref_init(&new->ref);  // the computation's
+    kref_get(&new->ref);   // the caller's
+    init_completion(&new->done);
+    hash_add(fib_flights, &new->node, k);
+    spin_unlock(&fib_flight_lock);
+
+    queue_work(fib_flight_wq, &new->work);
+    return new;
+}
+
+/* stop waiting for a flight, the last user to leave cancels it */
+static void fib_flight_leave(struct fib_flight *f)
+{
+    spin_lock(&fib_flight_lock);
+    if (!--f->users) {
+        hash_del(&f->node);
+        WRITE_ONCE(f->cancel, true);
+    }
+    spin_unlock(&fib_flight_lock);
+    kref_put(&f->ref, fib_flight_free);
+}
+
+/**
+ * fib_read_shared() - read() F(k) through a shared computation.
+ * @ff:     State of the calling file.
+ * @buf:    User buffer.
+ * @size:   Size of @buf.
+ * @k:      Index of the Fibonacci number.
+ * @format: FIB_FMT_BINARY or FIB_FMT_DECIMAL.
+ *
+ * The computation itself has no deadline. Each caller waits at most its
+ * own budget, so one caller's budget_ms never decides another caller's
+ * result, and the computation is cancelled once every caller gave up.
+ *
+ * Return: Cells or digits copied, or a negative errno.
+ */
+static ssize_t fib_read_shared(struct fib_file *ff,
+                               char *buf,
+                               size_t size,
+                               long long k,
+                               unsigned int format)
+{
+    struct fib_flight *f = fib_flight_join(k, format);
+    if (!f)
+        return -ENOMEM;
+
+    long timeout = ff->budget_ms ? msecs_to_jiffies(ff->budget_ms)
+                                 : MAX_SCHEDULE_TIMEOUT;
+    long rc = wait_for_completion_killable_timeout(&f->done, timeout);
+    ssize_t ret = rc < 0 ? rc : !rc ? -ETIME : f->err;
+    if (!ret) {
+        if (f->len > size)
+            ret = -ENOSPC;
+        else if (copy_to_user(buf, f->data, f->len))
+            ret = -EFAULT;
+        else if (format == FIB_FMT_DECIMAL)
+            ret = f->len;
+        else
+            ret = f->len / sizeof(unsigned int);
+    }
+    fib_flight_leave(f);
+    return ret;
+}
+
+static void fib_work(struct work_struct *work)
+{
+    struct fib_request *req = container_of(work, struct fib_request, work);
+    struct fib_file *ff = req->owner;
+    struct fib_ctx ctx;
+
+    // closing the file aborts computations nobody will read
+    fib_ctx_init(&ctx, req->budget_ms, &ff->closed);
+    req->fib =
+        fib_sequence_sized(req->k, estimate_size(req->k), NULL, &ctx);
+    req->status = req->fib ? 0 : ctx.err;
+
+    spin_lock(&ff->lock);
+    ff->pending--;
+    if (ff->closed) {
+        spin_unlock(&ff->lock);
+        fib_request_free(req);
+    } else {
+        list_add_tail(&req->list, &ff->done);
+        ff->ndone++;
+        spin_unlock(&ff->lock);
+        wake_up_interruptible(&ff->wait);
+    }
+    kref_put(&ff->ref, fib_file_free);
+}
+
+/* compute a prefetched result in the background, see fib_ra_update() */
+static void fib_ra_work(struct work_struct *work)
+{
+    struct fib_request *req = container_of(work, struct fib_request, work);
+    struct fib_file *ff = req->owner;
+    struct fib_ctx ctx;
+
+    // fib_ra_wq runs its workers at the lowest priority
+    fib_ctx_init(&ctx, req->budget_ms, &req->cancel);
+    req->fib =
+        fib_sequence_sized(req->k, estimate_size(req->k), NULL, &ctx);
+    req->status = req->fib ? 0 : ctx.err;
+
+    spin_lock(&ff->lock);
+    req->ready = true;
+    bool drop = req->cancel;
+    spin_unlock(&ff->lock);
+
+    if (drop) {
+        atomic_long_inc(&ra_wasted);
+        fib_request_free(req);
+    } else {
+        wake_up(&ff->wait);
+    }
+    kref_put(&ff->ref, fib_file_free);
+}
+
+/* take the prefetch of F(k) off ff->ra, NULL if there is none */
+static struct fib_request *fib_ra_take(struct fib_file *ff, long long k)
+{
+    struct fib_request *req;
+
+    spin_lock(&ff->lock);
+    list_for_each_entry (req, &ff->ra, list) {
+        if (req->k == k) {
+            list_del(&req->list);
+            ff->ra_count--;
+            spin_unlock(&ff->lock);
+            return req;
+        }
+    }
+    spin_unlock(&ff->lock);
+    return NULL;
+}
+
+static bool fib_ra_ready(struct fib_file *ff, struct fib_request *req)
+{
+    spin_lock(&ff->lock);
+    bool ready = req->ready;
+    spin_unlock(&ff->lock);
+    return ready;
+}
+
+/* whether k lies in the readahead window that follows a read() of from */
+static bool fib_ra_wanted(struct fib_file *ff,
+                          long long from,
+                          long long k,
+                          unsigned int window)
+{
+    long long d = k - from;
+    return d % ff->stride == 0 && d / ff->stride >= 1 &&
+           d / ff->stride <= window;
+}
+
+/**
+ * fib_ra_update() - Follow the pattern of synchronous read()s.
+ * @ff: State of the calling file.
+ * @k:  Index being read.
+ *
+ * Once two read()s in a row moved by the same non-zero stride, the next
+ * readahead results along that stride are computed on fib_ra_wq, and
+ * prefetches outside the window are dropped. A read() breaking the pattern
+ * leaves the prefetches alone until a new stride settles.
+ */
+static void fib_ra_update(struct fib_file *ff, long long k)
+{
+    unsigned int window = min_t(unsigned int, READ_ONCE(readahead), FIB_RA_MAX);
+    long long want[FIB_RA_MAX];
+    int n = 0;
+    struct fib_request *req, *tmp;
+    LIST_HEAD(freed);
+
+    spin_lock(&ff->lock);
+    long long stride = k - ff->last_k;
+    ff->streak = stride && stride == ff->stride ? ff->streak + 1 : 0;
+    ff->stride = stride;
+    ff->last_k = k;
+
+    if (window && !ff->streak) {
+        spin_unlock(&ff->lock);
+        return;
+    }
+    list_for_each_entry_safe (req, tmp, &ff->ra, list) {
+        if (window && fib_ra_wanted(ff, k, req->k, window))
+            continue;
+        list_del(&req->list);
+        ff->ra_count--;
+        fib_ra_drop(req, &freed);
+    }
+
+    for (unsigned int i = 1; i <= window; i++) {
+        long long next = k + i * stride;
+        if (next < 0 || next > MAX_LENGTH)
+            break;
+        bool found = false;
+        list_for_each_entry (req, &ff->ra, list)
+            found |= req->k == next;
+        if (!found && ff->ra_count + n < FIB_RA_MAX)
+            want[n++] = next;
+    }
+    spin_unlock(&ff->lock);
+    fib_ra_free(&freed);
+
+    for (int i = 0; i < n; i++) {
+        req = kzalloc(sizeof(*req), GFP_KERNEL);
+        if (!req)
+            break;
+        INIT_WORK(&req->work, fib_ra_work);
+        req->owner = ff;
+        req->k = want[i];
+        req->budget_ms = ff->budget_ms;
+
+        spin_lock(&ff->lock);
+        list_add_tail(&req->list, &ff->ra);
+        ff->ra_count++;
+        spin_unlock(&ff->lock);
+
+        kref_get(&ff->ref);
+        queue_work(fib_ra_wq, &req->work);
+    }
+}
+
+static bool fib_async_active(struct fib_file *ff)
+{
+    spin_lock(&ff->lock);
+    bool active = ff->pending || !list_empty(&ff->done);
+    spin_unlock(&ff->lock);
+    return active;
+}
+
+/* hand out the oldest completed request as a struct fib_result frame */
+static ssize_t fib_read_async(struct file *file, char *buf, size_t size)
+{
+    struct fib_file *ff = file->private_data;
+    struct fib_request *req;
+
+    spin_lock(&ff->lock);
+    while (list_empty(&ff->done)) {
+        spin_unlock(&ff->lock);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(ff->wait, !list_empty(&ff->done)))
+            return -ERESTARTSYS;
+        spin_lock(&ff->lock);
+    }
+    req = list_first_entry(&ff->done, struct fib_request, list);
+
+    struct fib_result res = {
+        .k = req->k,
+        .status = req->status,
+        .size = req->fib ? fib_cells(req->fib) : 0,
+    };
+    size_t len = sizeof(res) + res.size * sizeof(unsigned int);
+    if (size < len) {
+        spin_unlock(&ff->lock);
+        return -EINVAL;
+    }
+    list_del(&req->list);
+    ff->ndone--;
+    spin_unlock(&ff->lock);
+
+    if (copy_to_user(buf, &res, sizeof(res)) ||
+        (res.size && copy_to_user(buf + sizeof(res), req->fib->cell,
+                                  res.size * sizeof(unsigned int)))) {
+        // keep the result for the next read
+        spin_lock(&ff->lock);
+        list_add(&req->list, &ff->done);
+        ff->ndone++;
+        spin_unlock(&ff->lock);
+        return -EFAULT;
+    }
+    fib_request_free(req);
+    // the slot is free for write() again
+    wake_up_interruptible(&ff->wait);
+    return len;
+}
+
+/* F(k) as decimal digits from the base 10^9 engine, return their number */
+static ssize_t fib_read_decimal(struct fib_file *ff,
+                                char *buf,
+                                size_t size,
+                                long long k)
+{
+    if (k >= READ_ONCE(coalesce_min))
+        return fib_read_shared(ff, buf, size, k, FIB_FMT_DECIMAL);
+
+    struct fib_ctx ctx;
+    size_t len;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    char *str = fib_decimal_ws(k, &len, &ctx);
+    if (!str)
+        return ctx.err;
+
+    ssize_t ret = len;
+    if (len > size)
+        ret = -ENOSPC;
+    else if (copy_to_user(buf, str, len))
+        ret = -EFAULT;
+    fib_ws_put(ctx.ws);
+    return ret;
+}
+
 /* calculate the fibonacci number at given offset */
 static ssize_t fib_read(struct file *file,
                         char *buf,
                         size_t size,
                         loff_t *offset)
 {
+    struct fib_file *ff = file->private_data;
+    if (fib_async_active(ff))
+        return fib_read_async(file, buf, size);
+    if (ff->format == FIB_FMT_DECIMAL)
+        return fib_read_decimal(ff, buf, size, *offset);
+
     /* Check if buffer has enough size */
     int sz = estimate_size(*offset);
     if (size < sz * sizeof(unsigned int)) {
         return -1;
     }
 
-    struct BigN *fib = fib_sequence(*offset);
+    struct fib_request *req = fib_ra_take(ff, *offset);
+    fib_ra_update(ff, *offset);
+    if (req) {
+        // the prefetch may still be running, waiting beats starting over
+        int rc = wait_event_killable(ff->wait, fib_ra_ready(ff, req));
+        if (!rc && !req->status) {
+            int fib_size = req->fib->size;
+            bool fault = copy_to_user(buf, req->fib->cell,
+                                      fib_size * sizeof(unsigned int));
+            atomic_long_inc(&ra_useful);
+            fib_request_free(req);
+            return fault ? -EFAULT : fib_size;
+        }
+
+        LIST_HEAD(freed);
+        spin_lock(&ff->lock);
+        fib_ra_drop(req, &freed);
+        spin_unlock(&ff->lock);
+        fib_ra_free(&freed);
+        if (rc)
+            return rc;
+    }
+    if (*offset >= READ_ONCE(coalesce_min))
+        return fib_read_shared(ff, buf, size, *offset, FIB_FMT_BINARY);
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    struct BigN *fib = fib_sequence_ws(*offset, &ctx);
     if (!fib) {  // fail to calculate fib k
-        return -1;
+        return ctx.err;
     }
 
     int fib_size = fib->size;
     copy_to_user(buf, fib->cell, fib->size * sizeof(unsigned int));
-    destroy_ubig(fib);
+    fib_ws_put(ctx.ws);
     return fib_size;
 }
 
-/* write operation is skipped */
+
+/**
+ * fib_ioctl_range() - Write F(first)..F(last) as a framed stream.
+ * @ff:   State of the calling file.
+ * @argp: User space pointer to a struct fib_range.
+ *
+ * F(first) and F(first + 1) come from a single fib_sequence() run, every
+ * following value costs one ubig_add().
+ *
+ * Return: Number of bytes written to the user buffer, or a negative errno.
+ */
+static long fib_ioctl_range(struct fib_file *ff, struct fib_range __user *argp)
+{
+    struct fib_range req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.first > req.last || req.last > MAX_LENGTH)
+        return -EINVAL;
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    int sz = estimate_size(req.last + 1);
+    ubig *y = NULL, *x = fib_sequence_sized(req.first, sz, &y, &ctx);
+    ubig *z = new_ubig(sz);
+    long ret = 0;
+    if (!x || !y || !z) {
+        ret = ctx.err;
+        goto out;
+    }
+
+    char __user *dest = u64_to_user_ptr(req.buf);
+    unsigned long long pos = 0, count = 0;
+    for (unsigned long long i = req.first; i <= req.last; i++) {
+        unsigned int n = fib_cells(x);
+        if (pos + (n + 1) * sizeof(unsigned int) > req.size)
+            break;
+        if (copy_to_user(dest + pos, &n, sizeof(n)) ||
+            copy_to_user(dest + pos + sizeof(n), x->cell,
+                         n * sizeof(unsigned int))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        pos += (n + 1) * sizeof(unsigned int);
+        count++;
+
+        if (i == req.last)
+            break;
+        if (!(count & 0xff) && fib_checkpoint(&ctx)) {
+            ret = ctx.err;
+            goto out;
+        }
+        // (x, y) = (y, x + y) by rotating the three buffers
+        ubig_add(z, x, y);
+        ubig *tmp = x;
+        x = y;
+        y = z;
+        z = tmp;
+    }
+
+    if (!count) {
+        ret = -ENOSPC;
+        goto out;
+    }
+    if (put_user(count, &argp->count)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    ret = pos;
+out:
+    destroy_ubig(x);
+    destroy_ubig(y);
+    destroy_ubig(z);
+    return ret;
+}
+
+/**
+ * fib_ioctl_recurrence() - Evaluate a linear recurrence at one index.
+ * @ff:   State of the calling file.
+ * @argp: User space pointer to a struct fib_recurrence.
+ *
+ * Return: Number of bytes written to the user buffer, or a negative errno.
+ */
+static long fib_ioctl_recurrence(struct fib_file *ff,
+                                 struct fib_recurrence __user *argp)
+{
+    struct fib_recurrence req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    BUILD_BUG_ON(FIB_REC_MAX_ORDER > REC_MAX_ORDER);
+    if (!req.order || req.order > FIB_REC_MAX_ORDER ||
+        req.format > FIB_FMT_DECIMAL)
+        return -EINVAL;
+
+    int cells = rec_cells(req.order, req.coef, req.k);
+    if (!cells)
+        return -EOVERFLOW;
+
+    // the term and its digits live in the workspace next to rec_eval()
+    bool decimal = req.format == FIB_FMT_DECIMAL;
+    size_t str_size = decimal ? limbs_str_size(cells) : 0;
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    ctx.ws = fib_ws_get(rec_ws_bytes(req.order, cells) +
+                        FIB_WS_ALIGN(cells * sizeof(unsigned int)) +
+                        FIB_WS_ALIGN(str_size));
+    if (!ctx.ws)
+        return -ENOMEM;
+    unsigned int *term = fib_ws_alloc(ctx.ws, cells * sizeof(unsigned int));
+    char *str = fib_ws_alloc(ctx.ws, str_size);
+
+    long ret = rec_eval(term, cells, req.order, req.coef, req.init, req.k,
+                        &ctx);
+    if (ret)
+        goto out;
+
+    const void *src = term;
+    size_t len = max(rec_len(term, cells), 1) * sizeof(unsigned int);
+    if (decimal) {
+        len = limbs_get_str(str, term, cells);
+        src = str;
+    }
+    if (len > req.size) {
+        ret = -ENOSPC;
+        goto out;
+    }
+    if (copy_to_user(u64_to_user_ptr(req.buf), src, len)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    ret = len;
+out:
+    fib_ws_put(ctx.ws);
+    return ret;
+}
+
+/**
+ * fib_ioctl_digits() - Leading or trailing digits of F(k).
+ * @argp: User space pointer to a struct fib_digits.
+ *
+ * Return: 0 on success, or a negative errno.
+ */
+static long fib_ioctl_digits(struct fib_digits __user *argp)
+{
+    struct fib_digits req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    BUILD_BUG_ON(FIB_DIGITS_MAX > DIG_MAX);
+    if (!req.count || req.count > FIB_DIGITS_MAX ||
+        req.which > FIB_DIGITS_TRAILING)
+        return -EINVAL;
+
+    int n;
+    req.length = 0;
+    if (req.which == FIB_DIGITS_LEADING)
+        n = fib_leading_digits(req.digits, req.count, req.k, &req.length);
+    else
+        n = fib_trailing_digits(req.digits, req.count, req.k);
+    if (n < 0)
+        return n;
+    req.count = n;
+
+    return copy_to_user(argp, &req, sizeof(req)) ? -EFAULT : 0;
+}
+
+static long fib_ioctl_set_format(struct fib_file *ff, __u32 __user *argp)
+{
+    __u32 format;
+    if (get_user(format, argp))
+        return -EFAULT;
+    if (format > FIB_FMT_DECIMAL)
+        return -EINVAL;
+    ff->format = format;
+    return 0;
+}
+
+/**
+ * fib_ioctl_ring_setup() - Allocate the rings of the calling file.
+ * @ff:   State of the calling file.
+ * @argp: User space pointer to a struct fib_ring_params.
+ *
+ * Return: 0 on success, or a negative errno.
+ */
+static long fib_ioctl_ring_setup(struct fib_file *ff,
+                                 struct fib_ring_params __user *argp)
+{
+    struct fib_ring_params p;
+    if (copy_from_user(&p, argp, sizeof(p)))
+        return -EFAULT;
+    if (!is_power_of_2(p.sq_entries) || p.sq_entries > FIB_RING_MAX_ENTRIES ||
+        !is_power_of_2(p.cq_entries) || p.cq_entries > FIB_RING_MAX_ENTRIES ||
+        p.data_size > FIB_RING_MAX_DATA || p.resv)
+        return -EINVAL;
+
+    // indices, submissions and completions do not share cache lines
+    p.sq_off = L1_CACHE_ALIGN(sizeof(struct fib_ring));
+    p.cq_off =
+        L1_CACHE_ALIGN(p.sq_off + p.sq_entries * sizeof(struct fib_sqe));
+    p.data_off = PAGE_ALIGN(p.cq_off + p.cq_entries * sizeof(struct fib_cqe));
+    p.mmap_size = PAGE_ALIGN(p.data_off + p.data_size);
+
+    struct fib_rings *rings = kzalloc(sizeof(*rings), GFP_KERNEL);
+    if (!rings)
+        return -ENOMEM;
+    rings->mem = vmalloc_user(p.mmap_size);
+    if (!rings->mem) {
+        kfree(rings);
+        return -ENOMEM;
+    }
+    rings->p = p;
+    mutex_init(&rings->lock);
+
+    long ret = copy_to_user(argp, &p, sizeof(p)) ? -EFAULT : 0;
+    spin_lock(&ff->lock);
+    if (!ret && ff->rings)
+        ret = -EBUSY;
+    if (!ret)
+        ff->rings = rings;
+    spin_unlock(&ff->lock);
+    if (ret)
+        fib_rings_free(rings);
+    return ret;
+}
+
+static struct fib_rings *fib_rings_get(struct fib_file *ff)
+{
+    spin_lock(&ff->lock);
+    struct fib_rings *rings = ff->rings;
+    spin_unlock(&ff->lock);
+    return rings;
+}
+
+/* compute one submission into the result space and describe it in cqe */
+static void fib_ring_do(struct fib_file *ff,
+                        struct fib_rings *rings,
+                        const struct fib_sqe *sqe,
+                        struct fib_cqe *cqe)
+{
+    *cqe = (struct fib_cqe){.user_data = sqe->user_data, .k = sqe->k};
+    if (sqe->k > MAX_LENGTH || sqe->offset % sizeof(unsigned int) ||
+        (u64) sqe->offset + sqe->size > rings->p.data_size) {
+        cqe->status = -EINVAL;
+        return;
+    }
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    ubig *fib = fib_sequence_ws(sqe->k, &ctx);
+    if (!fib) {
+        cqe->status = ctx.err;
+        return;
+    }
+    cqe->size = fib_cells(fib);
+    if (cqe->size * sizeof(unsigned int) > sqe->size)
+        cqe->status = -ENOSPC;
+    else
+        memcpy(rings->mem + rings->p.data_off + sqe->offset, fib->cell,
+               cqe->size * sizeof(unsigned int));
+    fib_ws_put(ctx.ws);
+}
+
+/**
+ * fib_ioctl_ring_enter() - Complete everything posted to the rings.
+ * @ff: State of the calling file.
+ *
+ * Submissions are taken in order until the submission ring is empty or the
+ * completion ring is full. Each slot is copied before it is checked, so
+ * user space changing it meanwhile cannot cause harm.
+ *
+ * Return: Number of completions added, or a negative errno.
+ */
+static long fib_ioctl_ring_enter(struct fib_file *ff)
+{
+    struct fib_rings *rings = fib_rings_get(ff);
+    if (!rings)
+        return -EINVAL;
+    if (mutex_lock_interruptible(&rings->lock))
+        return -ERESTARTSYS;
+
+    struct fib_ring *ring = rings->mem;
+    struct fib_sqe *sq = rings->mem + rings->p.sq_off;
+    struct fib_cqe *cq = rings->mem + rings->p.cq_off;
+    u32 sq_mask = rings->p.sq_entries - 1, cq_mask = rings->p.cq_entries - 1;
+    u32 sq_tail = smp_load_acquire(&ring->sq_tail);
+    long done = 0;
+
+    // a tail more than a ring ahead of the head is garbage
+    if (sq_tail - rings->sq_head > rings->p.sq_entries) {
+        done = -EINVAL;
+        goto out;
+    }
+
+    while (rings->sq_head != sq_tail && !fatal_signal_pending(current)) {
+        // the slot of the next completion has to be reaped first
+        u32 cq_head = smp_load_acquire(&ring->cq_head);
+        if (rings->cq_tail - cq_head >= rings->p.cq_entries)
+            break;
+
+        struct fib_sqe sqe = sq[rings->sq_head & sq_mask];
+        smp_store_release(&ring->sq_head, ++rings->sq_head);
+
+        struct fib_cqe cqe;
+        fib_ring_do(ff, rings, &sqe, &cqe);
+        cq[rings->cq_tail & cq_mask] = cqe;
+        smp_store_release(&ring->cq_tail, ++rings->cq_tail);
+        done++;
+    }
+out:
+    mutex_unlock(&rings->lock);
+    return done;
+}
+
+/**
+ * fib_ioctl_zeck_encode() - Fibonacci code an array of integers.
+ * @ff:   State of the calling file.
+ * @argp: User space pointer to a struct fib_zeck.
+ *
+ * Values come in and codes go out through bounce buffers of FIB_ZECK_CHUNK
+ * bytes, so the only per-value cost is zeck_codeword() and zeck_put().
+ *
+ * Return: 0 on success, or a negative errno.
+ */
+static long fib_ioctl_zeck_encode(struct fib_file *ff,
+                                  struct fib_zeck __user *argp)
+{
+    struct fib_zeck req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.start > req.end)
+        return -EINVAL;
+
+    // a whole codeword has to fit behind the bytes waiting for a copy
+    u64 *vals = kmalloc(FIB_ZECK_CHUNK, GFP_KERNEL);
+    u8 *codes = kmalloc(FIB_ZECK_CHUNK + ZECK_MAX_BITS / 8 + 1, GFP_KERNEL);
+    long ret = 0;
+    if (!vals || !codes) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    const u64 __user *src = u64_to_user_ptr(req.values);
+    u8 __user *dest = (u8 __user *) u64_to_user_ptr(req.codes) + req.start / 8;
+    struct zeck_enc e = {.nacc = req.start % 8};
+    if (e.nacc) {
+        u8 first;
+        if (get_user(first, dest)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        e.acc = first & ((1U << e.nacc) - 1);
+    }
+
+    u64 bit = req.start, done = 0;
+    u8 *p = codes;
+    while (done < req.count) {
+        size_t n = min_t(u64, req.count - done, FIB_ZECK_CHUNK / sizeof(u64));
+        if (copy_from_user(vals, src + done, n * sizeof(u64))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        for (size_t i = 0; i < n; i++, done++) {
+            u64 lo, hi;
+            if (!vals[i]) {
+                ret = -EINVAL;
+                goto out;
+            }
+            int len = zeck_codeword(vals[i], &lo, &hi);
+            if (len > req.end - bit)
+                goto full;
+            p = zeck_put(&e, p, lo, hi, len);
+            bit += len;
+            if (p - codes >= FIB_ZECK_CHUNK) {
+                if (copy_to_user(dest, codes, p - codes)) {
+                    ret = -EFAULT;
+                    goto out;
+                }
+                dest += p - codes;
+                p = codes;
+            }
+        }
+        if (fib_checkpoint(&ctx)) {
+            ret = ctx.err;
+            goto out;
+        }
+    }
+full:
+    // the bits after the last codeword in its byte are zero
+    if (e.nacc)
+        *p++ = e.acc;
+    if (copy_to_user(dest, codes, p - codes)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    req.count = done;
+    req.end = bit;
+    if (copy_to_user(argp, &req, sizeof(req)))
+        ret = -EFAULT;
+out:
+    kfree(vals);
+    kfree(codes);
+    return ret;
+}
+
+/**
+ * fib_ioctl_zeck_decode() - Decode an array of integers from Fibonacci codes.
+ * @ff:   State of the calling file.
+ * @argp: User space pointer to a struct fib_zeck.
+ *
+ * Whole bytes go through zeck_dec_byte(), only the partial bytes at either
+ * end of the stream are decoded a bit at a time.
+ *
+ * Return: 0 on success, or a negative errno.
+ */
+static long fib_ioctl_zeck_decode(struct fib_file *ff,
+                                  struct fib_zeck __user *argp)
+{
+    struct fib_zeck req;
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.start > req.end)
+        return -EINVAL;
+
+    // a byte ends at most four codewords
+    const size_t room = FIB_ZECK_CHUNK / sizeof(u64) - 4;
+    u64 *vals = kmalloc(FIB_ZECK_CHUNK, GFP_KERNEL);
+    u8 *codes = kmalloc(FIB_ZECK_CHUNK, GFP_KERNEL);
+    long ret = 0;
+    if (!vals || !codes) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, ff->budget_ms, NULL);
+    const u8 __user *src = u64_to_user_ptr(req.codes);
+    u64 __user *dest = u64_to_user_ptr(req.values);
+    struct zeck_dec d = {0};
+    u64 bit = req.start, last = req.start, done = 0, first = bit / 8;
+    size_t n = 0, len = 0;
+    while (bit < req.end && done + n < req.count) {
+        if (n > room) {
+            if (copy_to_user(dest + done, vals, n * sizeof(u64))) {
+                ret = -EFAULT;
+                goto out;
+            }
+            done += n;
+            n = 0;
+        }
+        if (bit / 8 - first >= len) {
+            if (fib_checkpoint(&ctx)) {
+                ret = ctx.err;
+                goto out;
+            }
+            first = bit / 8;
+            len = min_t(u64, (req.end - 1) / 8 + 1 - first, FIB_ZECK_CHUNK);
+            if (copy_from_user(codes, src + first, len)) {
+                ret = -EFAULT;
+                goto out;
+            }
+        }
+
+        unsigned int c = codes[bit / 8 - first];
+        int r;
+        if (!(bit % 8) && req.end - bit >= 8) {
+            int end;
+            r = zeck_dec_byte(&d, c, vals + n,
+                              min_t(u64, req.count - done - n, 4), &end);
+            if (r > 0)
+                last = bit + end;
+            bit += 8;
+        } else {
+            r = zeck_dec_bit(&d, c >> bit % 8 & 1, vals + n);
+            if (r > 0)
+                last = bit + 1;
+            bit++;
+        }
+        if (r < 0) {
+            ret = r;
+            goto out;
+        }
+        n += r;
+    }
+    if (copy_to_user(dest + done, vals, n * sizeof(u64))) {
+        ret = -EFAULT;
+        goto out;
+    }
+    req.count = done + n;
+    req.end = last;
+    if (copy_to_user(argp, &req, sizeof(req)))
+        ret = -EFAULT;
+out:
+    kfree(vals);
+    kfree(codes);
+    return ret;
+}
+
+static long fib_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fib_file *ff = file->private_data;
+
+    switch (cmd) {
+    case FIB_IOC_RANGE:
+        return fib_ioctl_range(ff, (struct fib_range __user *) arg);
+    case FIB_IOC_SET_BUDGET:
+        return get_user(ff->budget_ms, (__u32 __user *) arg);
+    case FIB_IOC_RECURRENCE:
+        return fib_ioctl_recurrence(ff, (struct fib_recurrence __user *) arg);
+    case FIB_IOC_DIGITS:
+        return fib_ioctl_digits((struct fib_digits __user *) arg);
+    case FIB_IOC_SET_FORMAT:
+        return fib_ioctl_set_format(ff, (__u32 __user *) arg);
+    case FIB_IOC_RING_SETUP:
+        return fib_ioctl_ring_setup(ff, (struct fib_ring_params __user *) arg);
+    case FIB_IOC_RING_ENTER:
+        return fib_ioctl_ring_enter(ff);
+    case FIB_IOC_ZECK_ENCODE:
+        return fib_ioctl_zeck_encode(ff, (struct fib_zeck __user *) arg);
+    case FIB_IOC_ZECK_DECODE:
+        return fib_ioctl_zeck_decode(ff, (struct fib_zeck __user *) arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * whether write() has to wait, called with ff->lock held; unread results
+ * count as well, so they cannot pile up
+ */
+static bool fib_async_full(struct fib_file *ff)
+{
+    return ff->pending + ff->ndone >= MAX_INFLIGHT;
+}
+
+/* submit an array of __u64 indices for asynchronous computation */
 static ssize_t fib_write(struct file *file,
                          const char *buf,
                          size_t size,
                          loff_t *offset)
 {
-    return 1;
+    struct fib_file *ff = file->private_data;
+    size_t n = size / sizeof(__u64), i;
+    if (!n)
+        return -EINVAL;
+
+    for (i = 0; i < n; i++) {
+        __u64 k;
+        if (get_user(k, (const __u64 __user *) buf + i))
+            return i ? i * sizeof(__u64) : -EFAULT;
+        if (k > MAX_LENGTH)
+            return i ? i * sizeof(__u64) : -EINVAL;
+
+        struct fib_request *req = kzalloc(sizeof(*req), GFP_KERNEL);
+        if (!req)
+            return i ? i * sizeof(__u64) : -ENOMEM;
+        INIT_WORK(&req->work, fib_work);
+        req->owner = ff;
+        req->k = k;
+        req->budget_ms = ff->budget_ms;
+
+        spin_lock(&ff->lock);
+        if (fib_async_full(ff)) {
+            spin_unlock(&ff->lock);
+            kfree(req);
+            return i ? i * sizeof(__u64) : -EAGAIN;
+        }
+        ff->pending++;
+        spin_unlock(&ff->lock);
+
+        kref_get(&ff->ref);
+        queue_work(fib_wq, &req->work);
+    }
+    return n * sizeof(__u64);
+}
+
+static __poll_t fib_poll(struct file *file, poll_table *wait)
+{
+    struct fib_file *ff = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &ff->wait, wait);
+    spin_lock(&ff->lock);
+    if (!list_empty(&ff->done))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (!fib_async_full(ff))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    spin_unlock(&ff->lock);
+    return mask;
+}
+
+/* map the area of FIB_IOC_RING_SETUP */
+static int fib_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct fib_rings *rings = fib_rings_get(file->private_data);
+    if (!rings)
+        return -EINVAL;
+    return remap_vmalloc_range(vma, rings->mem, vma->vm_pgoff);
 }
 
 static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
@@ -112,12 +1466,68 @@ const struct file_operations fib_fops = {
     .open = fib_open,
     .release = fib_release,
     .llseek = fib_device_lseek,
+    .poll = fib_poll,
+    .mmap = fib_mmap,
+    .unlocked_ioctl = fib_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
 };
 
+/*
+ * readahead only uses idle time: its workqueue gets workers of its own at
+ * the lowest priority, so no shared worker is ever reniced
+ */
+static struct workqueue_struct *fib_alloc_ra_wq(void)
+{
+    struct workqueue_struct *wq = alloc_workqueue("fibdrv_ra", WQ_UNBOUND, 0);
+    struct workqueue_attrs *attrs = alloc_workqueue_attrs();
+    if (!wq || !attrs)
+        goto failed;
+    attrs->nice = MAX_NICE;
+    if (apply_workqueue_attrs(wq, attrs))
+        goto failed;
+    free_workqueue_attrs(attrs);
+    return wq;
+failed:
+    free_workqueue_attrs(attrs);
+    if (wq)
+        destroy_workqueue(wq);
+    return NULL;
+}
+
 static int __init init_fib_dev(void)
 {
     int rc = 0;
-    mutex_init(&fib_mutex);
+
+    // settle the multiplier thresholds before any computation can start
+    rc = limbs_tune(karatsuba_threshold, toom3_threshold);
+    if (rc) {
+        printk(KERN_ALERT "Failed to tune multiplication\n");
+        return rc;
+    }
+    karatsuba_threshold = limbs_karatsuba_threshold;
+    toom3_threshold = limbs_toom3_threshold;
+    printk(KERN_INFO "fibdrv: Karatsuba from %u limbs, Toom-3 from %u limbs\n",
+           karatsuba_threshold, toom3_threshold);
+    zeck_init();
+
+    fib_wq = alloc_workqueue("fibdrv", WQ_UNBOUND, 0);
+    if (!fib_wq) {
+        printk(KERN_ALERT "Failed to allocate workqueue\n");
+        return -ENOMEM;
+    }
+    fib_ra_wq = fib_alloc_ra_wq();
+    if (!fib_ra_wq) {
+        printk(KERN_ALERT "Failed to allocate workqueue\n");
+        destroy_workqueue(fib_wq);
+        return -ENOMEM;
+    }
+    fib_flight_wq = alloc_workqueue("fibdrv_flight", WQ_UNBOUND, 0);
+    if (!fib_flight_wq) {
+        printk(KERN_ALERT "Failed to allocate workqueue\n");
+        destroy_workqueue(fib_ra_wq);
+        destroy_workqueue(fib_wq);
+        return -ENOMEM;
+    }
 
     // Let's register the device
     // This will dynamically allocate the major number
@@ -150,15 +1560,22 @@ failed_device_create:
 failed_class_create:
 failed_cdev:
     unregister_chrdev(major, DEV_FIBONACCI_NAME);
+    destroy_workqueue(fib_flight_wq);
+    destroy_workqueue(fib_ra_wq);
+    destroy_workqueue(fib_wq);
     return rc;
 }
 
 static void __exit exit_fib_dev(void)
 {
-    mutex_destroy(&fib_mutex);
     device_destroy(fib_class, fib_dev);
     class_destroy(fib_class);
     unregister_chrdev(major, DEV_FIBONACCI_NAME);
+    // cancelled flights may still be winding down
+    destroy_workqueue(fib_flight_wq);
+    destroy_workqueue(fib_ra_wq);
+    destroy_workqueue(fib_wq);
+    fib_ws_exit();
 }
 
 module_init(init_fib_dev);
@@ -0,0 +1,251 @@
+#ifndef FIBDRV_H
+#define FIBDRV_H
+
+/* Interface shared by fibdrv.c and the user space programs. */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FIB_DEV "/dev/fibonacci"
+#define FIB_IOC_MAGIC 'f'
+
+/**
+ * struct fib_range - Request F(@first)..F(@last) in a single call.
+ * @first: Index of the first Fibonacci number.
+ * @last:  Index of the last Fibonacci number (inclusive).
+ * @buf:   User space address of the buffer receiving the stream.
+ * @size:  Size of @buf in bytes.
+ * @count: Set by the driver to the number of values written.
+ *
+ * The stream is a sequence of frames, one per index. Each frame is a __u32
+ * cell count n followed by n __u32 cells, least significant cell first.
+ * Frames that do not fit into @buf are left out, so a large range can be
+ * fetched in chunks by advancing @first by @count.
+ */
+struct fib_range {
+    __u64 first;
+    __u64 last;
+    __u64 buf;
+    __u64 size;
+    __u64 count;
+};
+
+#define FIB_IOC_RANGE _IOWR(FIB_IOC_MAGIC, 1, struct fib_range)
+
+/*
+ * Limit the compute time of every later request on this file to the given
+ * number of milliseconds (__u32, 0 for no limit). Requests running out of
+ * time fail with -ETIME. The default comes from the budget_ms parameter.
+ */
+#define FIB_IOC_SET_BUDGET _IOW(FIB_IOC_MAGIC, 2, __u32)
+
+/**
+ * struct fib_result - Header of a completed asynchronous request.
+ * @k:      Index that was submitted.
+ * @status: Zero on success, a negative errno if the computation failed.
+ * @size:   Number of __u32 cells following the header.
+ *
+ * Indices are submitted by write()-ing an array of __u64 to the device.
+ * Once anything is outstanding, read() returns one header plus its cells
+ * per call in completion order, and poll() reports readiness.
+ */
+struct fib_result {
+    __u64 k;
+    __s32 status;
+    __u32 size;
+};
+
+/* Output formats */
+#define FIB_FMT_BINARY 0  /* __u32 cells, least significant first */
+#define FIB_FMT_DECIMAL 1 /* ASCII decimal digits, no terminating NUL */
+
+#define FIB_REC_MAX_ORDER 8
+
+/**
+ * struct fib_recurrence - Evaluate a linear recurrence at one index.
+ * @order:  Order d of the recurrence, 1..FIB_REC_MAX_ORDER.
+ * @format: FIB_FMT_BINARY or FIB_FMT_DECIMAL.
+ * @k:      Index of the wanted term.
+ * @coef:   Coefficients, a(n) = coef[0] a(n-1) + ... + coef[d-1] a(n-d).
+ * @init:   Initial terms a(0)..a(d-1).
+ * @buf:    User space address of the buffer receiving a(k).
+ * @size:   Size of @buf in bytes.
+ *
+ * For example, Lucas numbers are order 2 with coef {1, 1} and init {2, 1},
+ * Pell numbers coef {2, 1} and init {0, 1}. The ioctl returns the number of
+ * bytes written. It fails with -EOVERFLOW if a(k) could exceed the size the
+ * driver is willing to compute, and with -ENOSPC if it does not fit @buf.
+ */
+struct fib_recurrence {
+    __u32 order;
+    __u32 format;
+    __u64 k;
+    __u32 coef[FIB_REC_MAX_ORDER];
+    __u32 init[FIB_REC_MAX_ORDER];
+    __u64 buf;
+    __u64 size;
+};
+
+#define FIB_IOC_RECURRENCE _IOW(FIB_IOC_MAGIC, 3, struct fib_recurrence)
+
+/* Which end of the number struct fib_digits asks for */
+#define FIB_DIGITS_LEADING 0
+#define FIB_DIGITS_TRAILING 1
+
+#define FIB_DIGITS_MAX 64
+
+/**
+ * struct fib_digits - Leading or trailing decimal digits of F(k).
+ * @k:      Index of the Fibonacci number, any value.
+ * @which:  FIB_DIGITS_LEADING or FIB_DIGITS_TRAILING.
+ * @count:  Number of digits wanted, 1..FIB_DIGITS_MAX. Set by the driver to
+ *          the number of digits stored, which is less only for leading
+ *          digits of an F(k) that short.
+ * @length: Set by the driver to the number of decimal digits of F(k) for
+ *          leading digits, 0 for trailing digits.
+ * @digits: ASCII digits, no terminating NUL. Trailing digits are F(k) mod
+ *          10^count with leading zeros.
+ *
+ * Neither query computes F(k), both take O(log k) operations on numbers of
+ * a few dozen digits, so @k is not limited by the size of F(k).
+ */
+struct fib_digits {
+    __u64 k;
+    __u32 which;
+    __u32 count;
+    __u64 length;
+    char digits[FIB_DIGITS_MAX];
+};
+
+#define FIB_IOC_DIGITS _IOWR(FIB_IOC_MAGIC, 4, struct fib_digits)
+
+/*
+ * Choose what a synchronous read() on this file returns (__u32): binary
+ * cells, counted by the return value (FIB_FMT_BINARY, the default), or
+ * decimal digits, counted in bytes (FIB_FMT_DECIMAL). Decimal results are
+ * computed in base 10^9 throughout, so no conversion is needed. A buffer
+ * too small for the digits fails the read() with -ENOSPC. Asynchronous
+ * results stay binary.
+ */
+#define FIB_IOC_SET_FORMAT _IOW(FIB_IOC_MAGIC, 5, __u32)
+
+/* Limits of struct fib_ring_params */
+#define FIB_RING_MAX_ENTRIES 4096
+#define FIB_RING_MAX_DATA (64 << 20)
+
+/**
+ * struct fib_ring_params - Geometry of the rings, see FIB_IOC_RING_SETUP.
+ * @sq_entries: Submission slots, a power of two up to FIB_RING_MAX_ENTRIES.
+ * @cq_entries: Completion slots, a power of two up to FIB_RING_MAX_ENTRIES.
+ * @data_size:  Bytes of result space, up to FIB_RING_MAX_DATA.
+ * @resv:       Must be zero.
+ * @mmap_size:  Set by the driver to the bytes to mmap() at offset 0.
+ * @sq_off:     Set by the driver to the offset of the struct fib_sqe array.
+ * @cq_off:     Set by the driver to the offset of the struct fib_cqe array.
+ * @data_off:   Set by the driver to the offset of the result space.
+ */
+struct fib_ring_params {
+    __u32 sq_entries;
+    __u32 cq_entries;
+    __u32 data_size;
+    __u32 resv;
+    __u64 mmap_size;
+    __u64 sq_off;
+    __u64 cq_off;
+    __u64 data_off;
+};
+
+/**
+ * struct fib_ring - Indices at the start of the mapping.
+ * @sq_head: Next submission the driver takes, advanced by the driver.
+ * @sq_tail: Next free submission slot, advanced by user space.
+ * @cq_head: Next completion user space reaps, advanced by user space.
+ * @cq_tail: Next free completion slot, advanced by the driver.
+ *
+ * Indices run freely and wrap at 2^32, index i lives in slot
+ * i & (entries - 1). A producer fills a slot before it stores the new tail
+ * with release semantics, a consumer loads the tail with acquire semantics.
+ */
+struct fib_ring {
+    __u32 sq_head;
+    __u32 sq_tail;
+    __u32 cq_head;
+    __u32 cq_tail;
+};
+
+/**
+ * struct fib_sqe - Submission of one index.
+ * @k:         Index of the wanted Fibonacci number.
+ * @user_data: Copied into the completion untouched.
+ * @offset:    Where the cells go in the result space, a multiple of 4.
+ * @size:      Bytes available there.
+ */
+struct fib_sqe {
+    __u64 k;
+    __u64 user_data;
+    __u32 offset;
+    __u32 size;
+};
+
+/**
+ * struct fib_cqe - Completion of one submission.
+ * @user_data: From the submission.
+ * @k:         From the submission.
+ * @status:    Zero on success, or a negative errno. -ENOSPC if the cells do
+ *             not fit, with @size telling how many are needed.
+ * @size:      Number of __u32 cells of F(k), least significant first.
+ */
+struct fib_cqe {
+    __u64 user_data;
+    __u64 k;
+    __s32 status;
+    __u32 size;
+};
+
+/*
+ * Share a submission ring, a completion ring and a result space with the
+ * driver, all in one area that user space maps with mmap() afterwards. A
+ * file sets up its rings once. Requests are posted by filling struct
+ * fib_sqe slots and advancing sq_tail, and FIB_IOC_RING_ENTER computes all
+ * posted requests in one system call. It returns the number of
+ * completions it added, and stops early while the completion ring is full.
+ */
+#define FIB_IOC_RING_SETUP _IOWR(FIB_IOC_MAGIC, 6, struct fib_ring_params)
+#define FIB_IOC_RING_ENTER _IO(FIB_IOC_MAGIC, 7)
+
+/**
+ * struct fib_zeck - Fibonacci coding of an array of integers.
+ * @values: User space address of an array of __u64.
+ * @codes:  User space address of the coded bit stream.
+ * @count:  In: values to encode, or room for decoded values. Out: values
+ *          encoded or decoded.
+ * @start:  Bit of @codes where the call begins. Bit i is bit i % 8 of byte
+ *          i / 8, least significant first.
+ * @end:    In: bit where the room for codes (encoding) or the stream
+ *          (decoding) ends. Out: bit after the last complete codeword, the
+ *          @start of a call continuing the stream.
+ *
+ * A value n >= 1 is coded as its Zeckendorf representation, the
+ * coefficients of F(2), F(3), ... lowest first, followed by a 1, so every
+ * codeword ends in the only "11" it contains. 2^64 - 1 takes 93 bits.
+ */
+struct fib_zeck {
+    __u64 values;
+    __u64 codes;
+    __u64 count;
+    __u64 start;
+    __u64 end;
+};
+
+/*
+ * Encoding stops before the first value whose codeword does not fit and
+ * fails with -EINVAL on a zero. Bits of @start's byte below @start are
+ * kept, the bits after the last codeword up to the end of its byte are
+ * cleared. Decoding stops after @count values or at the end of the stream,
+ * ignoring an incomplete codeword there, and fails with -EINVAL on a
+ * codeword too long for 64 bits. Both return 0 on success.
+ */
+#define FIB_IOC_ZECK_ENCODE _IOWR(FIB_IOC_MAGIC, 8, struct fib_zeck)
+#define FIB_IOC_ZECK_DECODE _IOWR(FIB_IOC_MAGIC, 9, struct fib_zeck)
+
+#endif /* FIBDRV_H */
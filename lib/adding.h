@@ -1,6 +1,10 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
 static inline int estimate_size(long long k)
 {
     if (k <= 43)
@@ -41,6 +45,27 @@ static inline void destroy_ubig(ubig *ptr)
     }
 }
 
+/* bytes of workspace taken by new_ubig_ws(ws, size) */
+static inline size_t ubig_ws_bytes(int size)
+{
+    return FIB_WS_ALIGN(sizeof(ubig)) +
+           FIB_WS_ALIGN(size * sizeof(unsigned int));
+}
+
+/* like new_ubig(), but carved from a workspace instead of the allocator */
+static inline ubig *new_ubig_ws(struct fib_ws *ws, int size)
+{
+    ubig *ptr = fib_ws_alloc(ws, sizeof(ubig));
+    unsigned int *cellptr = fib_ws_alloc(ws, size * sizeof(unsigned int));
+    if (!ptr || !cellptr)
+        return NULL;
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
 static inline void ubig_assign(ubig *dest, const ubig *src)
 {
     memcpy(dest->cell, src->cell, dest->size * sizeof(unsigned int));
@@ -48,48 +73,60 @@ static inline void ubig_assign(ubig *dest, const ubig *src)
 
 static inline void ubig_add(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] + b->cell[i];
+    limbs_add_n(dest->cell, a->cell, b->cell, a->size);
+}
 
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] += (dest->cell[i] < a->cell[i]);
+/* workspace needed by fib_sequence(k) */
+static inline size_t fib_ws_bytes(long long k)
+{
+    return 3 * ubig_ws_bytes(estimate_size(k));
 }
 
 /**
  * fib_sequence() - Calculate the k-th Fibonacci number.
  * @k:     Index of the Fibonacci number to calculate.
+ * @next:  If not NULL, receives F(k + 1), which then needs a workspace of
+ *         fib_ws_bytes(k + 1) bytes. It lives in @ctx->ws as well.
+ * @ctx:   Computation context with a workspace of fib_ws_bytes(k) bytes.
  *
- * Return: The k-th Fibonacci number on success.
+ * Return: The k-th Fibonacci number on success, NULL with @ctx->err set
+ * otherwise. The result lives in @ctx->ws.
  */
-static ubig *fib_sequence(long long k)
+static ubig *fib_sequence(long long k, ubig **next, struct fib_ctx *ctx)
 {
     if (k <= 1LL) {
-        ubig *result = new_ubig(1);
-        if (!result)
+        ubig *result = new_ubig_ws(ctx->ws, 1);
+        if (!result || (next && !(*next = new_ubig_ws(ctx->ws, 1))))
             return NULL;
+        if (next)
+            (*next)->cell[0] = 1U;
         result->cell[0] = (unsigned int) k;
         return result;
     }
 
-    int sz = estimate_size(k);
-    ubig *a = new_ubig(sz);
-    ubig *b = new_ubig(sz);
-    ubig *c = new_ubig(sz);
-    if (!a || !b || !c) {
-        destroy_ubig(a);
-        destroy_ubig(b);
-        destroy_ubig(c);
+    // F(k + 1) may take one more cell than F(k)
+    int sz = estimate_size(next ? k + 1 : k);
+    ubig *a = new_ubig_ws(ctx->ws, sz);
+    ubig *b = new_ubig_ws(ctx->ws, sz);
+    ubig *c = new_ubig_ws(ctx->ws, sz);
+    if (!a || !b || !c)
         return NULL;
-    }
 
     b->cell[0] = 1ULL;
     for (int i = 2; i <= k; i++) {
+        if (!(i & 0xff) && fib_checkpoint(ctx))
+            return NULL;
         ubig_add(c, a, b);
-        ubig_assign(a, b);
-        ubig_assign(b, c);
-    }
 
-    destroy_ubig(a);
-    destroy_ubig(b);
-    return c;
+        // rotate the buffers instead of copying: a, b, c = b, c, a
+        ubig *tmp = a;
+        a = b;
+        b = c;
+        c = tmp;
+    }
+    if (next) {
+        ubig_add(c, a, b);
+        *next = c;
+    }
+    return b;
 }
@@ -0,0 +1,64 @@
+#ifndef FIB_CHECKPOINT_H
+#define FIB_CHECKPOINT_H
+
+#include <linux/errno.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+
+struct fib_ws;
+
+/**
+ * struct fib_ctx - State of a single fib_sequence() call.
+ * @deadline: Jiffies after which the computation gives up, 0 for no limit.
+ * @cancel:   Optional flag another context raises to abort the computation.
+ * @err:      Why fib_sequence() returned NULL.
+ * @ws:       Workspace the engine takes all of its buffers from.
+ */
+struct fib_ctx {
+    unsigned long deadline;
+    const bool *cancel;
+    int err;
+    struct fib_ws *ws;
+};
+
+/**
+ * fib_ctx_init() - Prepare a context before calling fib_sequence().
+ * @ctx:       Context to initialize.
+ * @budget_ms: Compute-time budget in milliseconds, 0 for no limit.
+ * @cancel:    Optional cancellation flag, may be NULL.
+ */
+static inline void fib_ctx_init(struct fib_ctx *ctx,
+                                unsigned int budget_ms,
+                                const bool *cancel)
+{
+    ctx->deadline = budget_ms ? jiffies + msecs_to_jiffies(budget_ms) : 0;
+    if (budget_ms && !ctx->deadline)  // 0 means no limit
+        ctx->deadline = 1;
+    ctx->cancel = cancel;
+    ctx->err = -ENOMEM;
+    ctx->ws = NULL;
+}
+
+/**
+ * fib_checkpoint() - Give up the CPU if needed and check for an abort.
+ * @ctx: Context of the running computation.
+ *
+ * Called at iteration and recursion boundaries of the engines.
+ *
+ * Return: 0 to keep computing, or the negative errno also stored in
+ * @ctx->err when the computation has to stop.
+ */
+static inline int fib_checkpoint(struct fib_ctx *ctx)
+{
+    cond_resched();
+    if (fatal_signal_pending(current))
+        return ctx->err = -EINTR;
+    if (ctx->cancel && READ_ONCE(*ctx->cancel))
+        return ctx->err = -ECANCELED;
+    if (ctx->deadline && time_after(jiffies, ctx->deadline))
+        return ctx->err = -ETIME;
+    return 0;
+}
+
+#endif /* FIB_CHECKPOINT_H */
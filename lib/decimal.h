@@ -0,0 +1,376 @@
+#ifndef FIB_DECIMAL_H
+#define FIB_DECIMAL_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "checkpoint.h"
+#include "workspace.h"
+
+/*
+ * Arithmetic on little-endian arrays of base 10^9 limbs, each holding nine
+ * decimal digits, and a fast-doubling engine on top of it. A number in
+ * this radix prints as ASCII with a single pass over its limbs, instead of
+ * the quadratic conversion binary cells need.
+ *
+ * The layout follows lib/limbs.h: schoolbook products below
+ * DEC_KARATSUBA_THRESHOLD limbs and subtractive Karatsuba above, with all
+ * temporaries in a scratch area of dec_mul_scratch(n) limbs. A limb
+ * product is below 10^18, so a product plus two limbs fits 64 bits.
+ */
+
+#define DEC_BASE 1000000000U
+#define DEC_DIGITS 9
+#define DEC_KARATSUBA_THRESHOLD 24
+
+/* r[0..n) = a + b, return the carry out. r may alias a or b. */
+static inline unsigned int dec_add_n(unsigned int *r,
+                                     const unsigned int *a,
+                                     const unsigned int *b,
+                                     int n)
+{
+    unsigned int carry = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int t = a[i] + b[i] + carry;  // below 2^31
+        carry = t >= DEC_BASE;
+        r[i] = carry ? t - DEC_BASE : t;
+    }
+    return carry;
+}
+
+/* r[0..n) = a - b, return the borrow out. r may alias a or b. */
+static inline unsigned int dec_sub_n(unsigned int *r,
+                                     const unsigned int *a,
+                                     const unsigned int *b,
+                                     int n)
+{
+    unsigned int borrow = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int x = a[i], t = b[i] + borrow;
+        borrow = x < t;
+        r[i] = borrow ? x + DEC_BASE - t : x - t;
+    }
+    return borrow;
+}
+
+/* r[0..an) = a[0..an) + b[0..bn) with an >= bn, return the carry out */
+static inline unsigned int dec_add(unsigned int *r,
+                                   const unsigned int *a,
+                                   int an,
+                                   const unsigned int *b,
+                                   int bn)
+{
+    unsigned int carry = dec_add_n(r, a, b, bn);
+    for (int i = bn; i < an; i++) {
+        unsigned int t = a[i] + carry;
+        carry = t == DEC_BASE;
+        r[i] = carry ? 0 : t;
+    }
+    return carry;
+}
+
+/* r[0..an) = a[0..an) - b[0..bn) with an >= bn, return the borrow out */
+static inline unsigned int dec_sub(unsigned int *r,
+                                   const unsigned int *a,
+                                   int an,
+                                   const unsigned int *b,
+                                   int bn)
+{
+    unsigned int borrow = dec_sub_n(r, a, b, bn);
+    for (int i = bn; i < an; i++) {
+        unsigned int x = a[i];
+        r[i] = borrow && !x ? DEC_BASE - 1 : x - borrow;
+        borrow = borrow && !x;
+    }
+    return borrow;
+}
+
+/* r[off..rn) += x[0..xn), dropping the carry out of r */
+static inline void dec_add_at(unsigned int *r,
+                              int rn,
+                              int off,
+                              const unsigned int *x,
+                              int xn)
+{
+    if (xn > rn - off)
+        xn = rn - off;  // the limbs cut off are zero
+    dec_add(r + off, r + off, rn - off, x, xn);
+}
+
+/* r[0..n) = |a - b|, return 1 when a < b. r may alias a or b. */
+static inline int dec_diff_n(unsigned int *r,
+                             const unsigned int *a,
+                             const unsigned int *b,
+                             int n)
+{
+    int i = n - 1;
+    while (i >= 0 && a[i] == b[i])
+        i--;
+    if (i >= 0 && a[i] < b[i]) {
+        dec_sub_n(r, b, a, n);
+        return 1;
+    }
+    dec_sub_n(r, a, b, n);
+    return 0;
+}
+
+/* used length of x, 0 for zero */
+static inline int dec_len(const unsigned int *x, int n)
+{
+    while (n > 0 && !x[n - 1])
+        n--;
+    return n;
+}
+
+/* r[0..an+bn) = a * b, r must not overlap the operands */
+static inline void dec_mul_basecase(unsigned int *r,
+                                    const unsigned int *a,
+                                    int an,
+                                    const unsigned int *b,
+                                    int bn)
+{
+    memset(r, 0, (an + bn) * sizeof(unsigned int));
+    for (int i = 0; i < bn; i++) {
+        u64 carry = 0;
+        for (int j = 0; j < an; j++) {
+            u64 t = (u64) a[j] * b[i] + r[i + j] + carry;
+            carry = div_u64_rem(t, DEC_BASE, &r[i + j]);
+        }
+        r[i + an] = carry;
+    }
+}
+
+/* r[0..2n) = a^2, computing every cross product only once */
+static inline void dec_sqr_basecase(unsigned int *r,
+                                    const unsigned int *a,
+                                    int n)
+{
+    memset(r, 0, 2 * n * sizeof(unsigned int));
+
+    // r = sum of a[i] * a[j] for i < j
+    for (int i = 0; i < n - 1; i++) {
+        u64 carry = 0;
+        for (int j = i + 1; j < n; j++) {
+            u64 t = (u64) a[i] * a[j] + r[i + j] + carry;
+            carry = div_u64_rem(t, DEC_BASE, &r[i + j]);
+        }
+        r[i + n] = carry;
+    }
+
+    // r = 2 * r + sum of a[i]^2, the square sits on limbs 2i and 2i + 1
+    u64 carry = 0;
+    for (int i = 0; i < 2 * n; i++) {
+        u64 t = 2 * (u64) r[i] + carry;
+        if (!(i & 1))
+            t += (u64) a[i / 2] * a[i / 2];
+        carry = div_u64_rem(t, DEC_BASE, &r[i]);
+    }
+}
+
+static void dec_mul_n(unsigned int *r,
+                      const unsigned int *a,
+                      const unsigned int *b,
+                      int n,
+                      unsigned int *scratch);
+
+/**
+ * dec_mul_karatsuba() - Multiply two n-limb numbers with Karatsuba.
+ * @r:       Result of 2 * @n limbs, must not overlap the operands.
+ * @a:       First operand.
+ * @b:       Second operand, may be equal to @a for squaring.
+ * @n:       Number of limbs of each operand, at least 2.
+ * @scratch: dec_mul_scratch(@n) limbs of temporary space.
+ *
+ * Same scheme as limbs_mul_karatsuba() in base 10^9.
+ */
+static void dec_mul_karatsuba(unsigned int *r,
+                              const unsigned int *a,
+                              const unsigned int *b,
+                              int n,
+                              unsigned int *scratch)
+{
+    int l = n / 2, h = n - l;  // low and high halves, h >= l
+    unsigned int *da = scratch;
+    unsigned int *db = da + h;
+    unsigned int *dm = db + h;
+    unsigned int *t = dm + 2 * h;
+    unsigned int *next = t + 2 * h + 1;
+    bool sqr = a == b;
+
+    // z0 = a0 * b0 in r[0..2l), z2 = a1 * b1 in r[2l..2n)
+    dec_mul_n(r, a, b, l, next);
+    dec_mul_n(r + 2 * l, a + l, b + l, h, next);
+
+    // dm = |a0 - a1| * |b0 - b1|, with a0 and b0 padded to h limbs
+    int neg = 0;
+    memset(da, 0, 2 * h * sizeof(unsigned int));
+    memcpy(da, a, l * sizeof(unsigned int));
+    neg ^= dec_diff_n(da, da, a + l, h);
+    if (sqr) {
+        neg = 0;  // a square is never negative
+        dec_mul_n(dm, da, da, h, next);
+    } else {
+        memcpy(db, b, l * sizeof(unsigned int));
+        neg ^= dec_diff_n(db, db, b + l, h);
+        dec_mul_n(dm, da, db, h, next);
+    }
+
+    // t = z0 + z2 -/+ dm, then r += t * 10^(9 l)
+    memset(t, 0, (2 * h + 1) * sizeof(unsigned int));
+    memcpy(t, r, 2 * l * sizeof(unsigned int));
+    t[2 * h] = dec_add_n(t, t, r + 2 * l, 2 * h);
+    if (neg)
+        dec_add(t, t, 2 * h + 1, dm, 2 * h);
+    else
+        dec_sub(t, t, 2 * h + 1, dm, 2 * h);
+    dec_add_at(r, 2 * n, l, t, 2 * h + 1);
+}
+
+/* scratch space needed by dec_mul_n(n), does not decrease with n */
+static size_t dec_mul_scratch(int n)
+{
+    if (n < DEC_KARATSUBA_THRESHOLD)
+        return 0;
+    int h = n - n / 2;
+    return 6 * h + 1 + dec_mul_scratch(h);
+}
+
+/* r[0..2n) = a * b, squaring when a == b */
+static void dec_mul_n(unsigned int *r,
+                      const unsigned int *a,
+                      const unsigned int *b,
+                      int n,
+                      unsigned int *scratch)
+{
+    if (n >= DEC_KARATSUBA_THRESHOLD)
+        dec_mul_karatsuba(r, a, b, n, scratch);
+    else if (a == b)
+        dec_sqr_basecase(r, a, n);
+    else
+        dec_mul_basecase(r, a, n, b, n);
+}
+
+/* bytes dec_get_str() may write for an n-limb number */
+static inline size_t dec_str_size(int n)
+{
+    return DEC_DIGITS * (size_t) max(n, 1);
+}
+
+/**
+ * dec_get_str() - Print a number as decimal ASCII digits.
+ * @str: Buffer of dec_str_size(@n) bytes, receives the digits without a
+ *       terminating NUL.
+ * @x:   The number.
+ * @n:   Number of limbs of @x.
+ *
+ * Return: Number of digits written, "0" for zero.
+ */
+static size_t dec_get_str(char *str, const unsigned int *x, int n)
+{
+    size_t len = 0;
+
+    n = dec_len(x, n);
+    if (!n) {
+        str[0] = '0';
+        return 1;
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        char chunk[DEC_DIGITS];
+        unsigned int v = x[i];
+        for (int j = DEC_DIGITS - 1; j >= 0; j--, v /= 10)
+            chunk[j] = '0' + v % 10;
+
+        int skip = 0;  // no leading zeros in the top limb
+        while (i == n - 1 && skip < DEC_DIGITS - 1 && chunk[skip] == '0')
+            skip++;
+        memcpy(str + len, chunk + skip, DEC_DIGITS - skip);
+        len += DEC_DIGITS - skip;
+    }
+    return len;
+}
+
+/* limbs holding F(k) and F(k + 1), as log10(phi) < 0.20899 */
+static inline int dec_size(long long k)
+{
+    return (k * 20899 / 100000 + 2) / DEC_DIGITS + 1;
+}
+
+/* workspace needed by dec_fib(k): four numbers, a product and scratch */
+static inline size_t dec_ws_bytes(long long k)
+{
+    int sz = dec_size(k);
+    return 4 * FIB_WS_ALIGN(sz * sizeof(unsigned int)) +
+           FIB_WS_ALIGN(2 * sz * sizeof(unsigned int)) +
+           FIB_WS_ALIGN(dec_mul_scratch(sz) * sizeof(unsigned int));
+}
+
+/* r[0..sz) = a * b cut to sz limbs, multiplying the used limbs only */
+static int dec_mul_fit(unsigned int *r,
+                       const unsigned int *a,
+                       const unsigned int *b,
+                       int sz,
+                       unsigned int *prod,
+                       unsigned int *scratch,
+                       struct fib_ctx *ctx)
+{
+    int n = max(dec_len(a, sz), dec_len(b, sz));
+
+    memset(r, 0, sz * sizeof(unsigned int));
+    if (!n)
+        return 0;
+    if (fib_checkpoint(ctx))
+        return ctx->err;
+    dec_mul_n(prod, a, b, n, scratch);
+    memcpy(r, prod, min(2 * n, sz) * sizeof(unsigned int));
+    return 0;
+}
+
+/**
+ * dec_fib() - Calculate F(k) in base 10^9 by fast doubling.
+ * @k:   Index of the Fibonacci number.
+ * @len: Receives the number of limbs of F(k).
+ * @ctx: Computation context with a workspace of dec_ws_bytes(@k) bytes.
+ *
+ * Return: F(k) in the workspace, or NULL with the reason in @ctx->err.
+ */
+static unsigned int *dec_fib(long long k, int *len, struct fib_ctx *ctx)
+{
+    int sz = dec_size(k);
+    size_t bytes = sz * sizeof(unsigned int);
+    unsigned int *a = fib_ws_alloc(ctx->ws, bytes);
+    unsigned int *b = fib_ws_alloc(ctx->ws, bytes);
+    unsigned int *t1 = fib_ws_alloc(ctx->ws, bytes);
+    unsigned int *t2 = fib_ws_alloc(ctx->ws, bytes);
+    unsigned int *prod = fib_ws_alloc(ctx->ws, 2 * bytes);
+    unsigned int *scratch =
+        fib_ws_alloc(ctx->ws, dec_mul_scratch(sz) * sizeof(unsigned int));
+    if (!a || !b || !t1 || !t2 || !prod || !scratch)
+        return NULL;
+    memset(a, 0, bytes);
+    memset(b, 0, bytes);
+    b[0] = 1;
+
+    for (int bit = fls64(k) - 1; bit >= 0; bit--) {
+        dec_add_n(t1, b, b, sz);  // t1 = 2 * b - a
+        dec_sub_n(t1, t1, a, sz);
+        if (dec_mul_fit(t2, a, t1, sz, prod, scratch, ctx) ||  // a (2b - a)
+            dec_mul_fit(t1, a, a, sz, prod, scratch, ctx) ||   // a^2
+            dec_mul_fit(a, b, b, sz, prod, scratch, ctx))      // b^2
+            return NULL;
+        dec_add_n(b, t1, a, sz);  // b = a^2 + b^2
+        swap(a, t2);
+
+        if (k >> bit & 1) {
+            dec_add_n(t1, a, b, sz);
+            swap(a, b);
+            swap(b, t1);
+        }
+    }
+
+    *len = max(dec_len(a, sz), 1);
+    return a;
+}
+
+#endif /* FIB_DECIMAL_H */
@@ -0,0 +1,289 @@
+#ifndef FIB_DIGITS_H
+#define FIB_DIGITS_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "decimal.h"
+
+/*
+ * Leading and trailing decimal digits of F(k) without computing F(k).
+ *
+ * Both run fast doubling on a handful of base 10^9 limbs, so a query costs
+ * O(log k) short products whatever the size of F(k):
+ *
+ * - Trailing digits are exact: F(k) mod 10^(9 n) is computed in that ring.
+ * - Leading digits come from floating-point numbers with a mantissa of a
+ *   few limbs. Every operation rounds in one direction, so running once
+ *   rounding down and once rounding up brackets F(k). Digits on which both
+ *   bounds agree are correct; if they disagree, the precision is doubled.
+ */
+
+/* most digits a single query returns */
+#define DIG_MAX 64
+
+/* largest mantissa tried for leading digits, in base 10^9 limbs */
+#define DIG_MAX_LIMBS 48
+
+#define DIG_TRAIL_LIMBS DIV_ROUND_UP(DIG_MAX, 9)
+
+/* value m[0..len) * DEC_BASE^exp, zero when len is 0 */
+struct dig_float {
+    int len;
+    long long exp;
+    unsigned int m[DIG_MAX_LIMBS];
+};
+
+/* r[0..n) = a * b mod 10^(9 n), r must not overlap the operands */
+static void dig_mul_low(unsigned int *r,
+                        const unsigned int *a,
+                        const unsigned int *b,
+                        int n)
+{
+    memset(r, 0, n * sizeof(unsigned int));
+    for (int i = 0; i < n; i++) {
+        u64 carry = 0;
+        for (int j = 0; i + j < n; j++) {
+            u64 t = (u64) a[i] * b[j] + r[i + j] + carry;
+            carry = div_u64_rem(t, DEC_BASE, &r[i + j]);
+        }
+    }
+}
+
+/*
+ * x = t[0..n) * DEC_BASE^exp cut to prec limbs, rounding down, or up when
+ * up is set. inexact tells that t is already below the value to round up.
+ * t needs one spare limb past n for the carry of rounding up.
+ */
+static void dig_set(struct dig_float *x,
+                    unsigned int *t,
+                    int n,
+                    long long exp,
+                    int prec,
+                    bool up,
+                    bool inexact)
+{
+    while (n > 0 && !t[n - 1])
+        n--;
+    if (n > prec) {
+        int drop = n - prec;
+        for (int i = 0; i < drop; i++)
+            inexact |= t[i] != 0;
+        t += drop;
+        n -= drop;
+        exp += drop;
+    }
+
+    if (up && inexact) {
+        int i = 0;
+        while (i < n && t[i] == DEC_BASE - 1)
+            t[i++] = 0;
+        if (i < n) {
+            t[i]++;
+        } else {
+            t[n++] = 1;
+            if (n > prec) {  // the limb falling off is zero now
+                t++;
+                n--;
+                exp++;
+            }
+        }
+    }
+
+    memcpy(x->m, t, n * sizeof(unsigned int));
+    x->len = n;
+    x->exp = exp;
+}
+
+/* x = a * b, t holds 2 * prec + 2 limbs */
+static void dig_mul(struct dig_float *x,
+                    const struct dig_float *a,
+                    const struct dig_float *b,
+                    int prec,
+                    bool up,
+                    unsigned int *t)
+{
+    if (!a->len || !b->len) {
+        x->len = 0;
+        x->exp = 0;
+        return;
+    }
+    dec_mul_basecase(t, a->m, a->len, b->m, b->len);
+    dig_set(x, t, a->len + b->len, a->exp + b->exp, prec, up, false);
+}
+
+/* x = a + b, t holds 2 * prec + 2 limbs */
+static void dig_add(struct dig_float *x,
+                    const struct dig_float *a,
+                    const struct dig_float *b,
+                    int prec,
+                    bool up,
+                    unsigned int *t)
+{
+    if (b->exp + b->len > a->exp + a->len)
+        swap(a, b);  // a reaches the higher limb
+    if (!b->len) {
+        memcpy(t, a->m, a->len * sizeof(unsigned int));
+        dig_set(x, t, a->len, a->exp, prec, up, false);
+        return;
+    }
+    if (b->exp + b->len <= a->exp) {
+        // b is less than one unit of the last limb of a
+        memcpy(t, a->m, a->len * sizeof(unsigned int));
+        dig_set(x, t, a->len, a->exp, prec, up, true);
+        return;
+    }
+
+    // both overlap, so the sum spans at most 2 * prec + 1 limbs
+    long long exp = min(a->exp, b->exp);
+    int n = a->exp + a->len - exp + 1;
+    memset(t, 0, n * sizeof(unsigned int));
+    dec_add_at(t, n, a->exp - exp, a->m, a->len);
+    dec_add_at(t, n, b->exp - exp, b->m, b->len);
+    dig_set(x, t, n, exp, prec, up, false);
+}
+
+/**
+ * struct dig_state - Working memory of fib_leading_digits().
+ * @f:   F(n - 1), F(n) and F(n + 1).
+ * @g:   The same for the next n.
+ * @s:   Temporary sum.
+ * @t:   Temporary limbs for products and sums.
+ * @str: Digits of the lower and the upper bound.
+ */
+struct dig_state {
+    struct dig_float f[3], g[3], s;
+    unsigned int t[2 * DIG_MAX_LIMBS + 2];
+    char str[2][9 * DIG_MAX_LIMBS];
+};
+
+/* a bound of F(k) in st->f[1], rounding every step down or up */
+static void dig_fib(struct dig_state *st, u64 k, int prec, bool up)
+{
+    struct dig_float *f = st->f, *g = st->g;
+
+    // start at n = 0 with F(-1) = 1, F(0) = 0, F(1) = 1
+    memset(f, 0, sizeof(st->f));
+    f[0].len = f[2].len = 1;
+    f[0].m[0] = f[2].m[0] = 1;
+
+    for (int bit = fls64(k) - 1; bit >= 0; bit--) {
+        // F(2n - 1) = F(n)^2 + F(n - 1)^2
+        dig_mul(&g[0], &f[1], &f[1], prec, up, st->t);
+        dig_mul(&st->s, &f[0], &f[0], prec, up, st->t);
+        dig_add(&g[0], &g[0], &st->s, prec, up, st->t);
+        // F(2n) = F(n) (F(n + 1) + F(n - 1))
+        dig_add(&st->s, &f[2], &f[0], prec, up, st->t);
+        dig_mul(&g[1], &f[1], &st->s, prec, up, st->t);
+        // F(2n + 1) = F(n + 1)^2 + F(n)^2
+        dig_mul(&g[2], &f[2], &f[2], prec, up, st->t);
+        dig_mul(&st->s, &f[1], &f[1], prec, up, st->t);
+        dig_add(&g[2], &g[2], &st->s, prec, up, st->t);
+
+        if (k >> bit & 1) {
+            f[0] = g[1];
+            f[1] = g[2];
+            dig_add(&f[2], &g[1], &g[2], prec, up, st->t);
+        } else {
+            memcpy(f, g, sizeof(st->g));
+        }
+    }
+}
+
+/* all digits of the mantissa of x, return how many */
+static int dig_str(char *s, const struct dig_float *x)
+{
+    return dec_get_str(s, x->m, x->len);
+}
+
+/**
+ * fib_leading_digits() - The first decimal digits of F(k).
+ * @out:    Receives the digits, no terminating NUL.
+ * @count:  Number of digits wanted, 1..DIG_MAX.
+ * @k:      Index of the Fibonacci number.
+ * @length: Receives the number of decimal digits of F(k).
+ *
+ * Return: Number of digits written, fewer than @count only if F(k) is that
+ * short, or a negative errno.
+ */
+static int fib_leading_digits(char *out, int count, u64 k, u64 *length)
+{
+    struct dig_state *st = kmalloc(sizeof(*st), GFP_KERNEL);
+    int ret = -ERANGE;
+    if (!st)
+        return -ENOMEM;
+
+    // fast doubling loses about log10(k) digits, 19 at most
+    for (int prec = DIV_ROUND_UP(count, 9) + 4; prec <= DIG_MAX_LIMBS;
+         prec *= 2) {
+        struct dig_float lo;
+        dig_fib(st, k, prec, false);
+        lo = st->f[1];
+        dig_fib(st, k, prec, true);
+
+        int lo_len = dig_str(st->str[0], &lo);
+        int hi_len = dig_str(st->str[1], &st->f[1]);
+        u64 lo_total = lo_len + 9 * lo.exp;
+        u64 hi_total = hi_len + 9 * st->f[1].exp;
+        int n = min_t(u64, count, lo_total);
+        if (lo_total == hi_total && !memcmp(st->str[0], st->str[1], n)) {
+            memcpy(out, st->str[0], n);
+            *length = lo_total;
+            ret = n;
+            break;
+        }
+    }
+
+    kfree(st);
+    return ret;
+}
+
+/**
+ * fib_trailing_digits() - The last decimal digits of F(k).
+ * @out:   Receives F(k) mod 10^@count as exactly @count digits, with leading
+ *         zeros, no terminating NUL.
+ * @count: Number of digits wanted, 1..DIG_MAX.
+ * @k:     Index of the Fibonacci number.
+ *
+ * Return: @count.
+ */
+static int fib_trailing_digits(char *out, int count, u64 k)
+{
+    unsigned int a[DIG_TRAIL_LIMBS] = {0}, b[DIG_TRAIL_LIMBS] = {1};
+    unsigned int t1[DIG_TRAIL_LIMBS], t2[DIG_TRAIL_LIMBS];
+    unsigned int c[DIG_TRAIL_LIMBS], d[DIG_TRAIL_LIMBS];
+    int n = DIV_ROUND_UP(count, 9);
+
+    for (int bit = fls64(k) - 1; bit >= 0; bit--) {
+        dec_sub_n(t1, b, a, n);  // t1 = 2 * b - a
+        dec_add_n(t1, t1, b, n);
+        dig_mul_low(c, a, t1, n);  // c = a * (2 * b - a)
+        dig_mul_low(t1, a, a, n);  // d = a^2 + b^2
+        dig_mul_low(t2, b, b, n);
+        dec_add_n(d, t1, t2, n);
+
+        if (k >> bit & 1) {
+            memcpy(a, d, n * sizeof(unsigned int));
+            dec_add_n(b, c, d, n);
+        } else {
+            memcpy(a, c, n * sizeof(unsigned int));
+            memcpy(b, d, n * sizeof(unsigned int));
+        }
+    }
+
+    // a holds 9 n digits, lowest limb last, of which the last count stay
+    int skip = n * 9 - count;
+    for (int i = n * 9 - 1, limb = 0; limb < n; limb++) {
+        unsigned int v = a[limb];
+        for (int j = 0; j < 9; j++, i--, v /= 10) {
+            if (i >= skip)
+                out[i - skip] = '0' + v % 10;
+        }
+    }
+    return count;
+}
+
+#endif /* FIB_DIGITS_H */
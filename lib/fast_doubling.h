@@ -1,6 +1,10 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
 static inline int estimate_size(long long k)
 {
     if (k <= 43)
@@ -41,6 +45,27 @@ static inline void destroy_ubig(ubig *ptr)
     }
 }
 
+/* bytes of workspace taken by new_ubig_ws(ws, size) */
+static inline size_t ubig_ws_bytes(int size)
+{
+    return FIB_WS_ALIGN(sizeof(ubig)) +
+           FIB_WS_ALIGN(size * sizeof(unsigned int));
+}
+
+/* like new_ubig(), but carved from a workspace instead of the allocator */
+static inline ubig *new_ubig_ws(struct fib_ws *ws, int size)
+{
+    ubig *ptr = fib_ws_alloc(ws, sizeof(ubig));
+    unsigned int *cellptr = fib_ws_alloc(ws, size * sizeof(unsigned int));
+    if (!ptr || !cellptr)
+        return NULL;
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
 static inline void zero_ubig(ubig *x)
 {
     memset(x->cell, 0, x->size * sizeof(unsigned int));
@@ -53,129 +78,136 @@ static inline void ubig_assign(ubig *dest, ubig *src)
 
 static inline void ubig_add(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] + b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] += (dest->cell[i] < a->cell[i]);
+    limbs_add_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 static inline void ubig_sub(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] - b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] -= (dest->cell[i] > a->cell[i]);
+    limbs_sub_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 static inline void ubig_lshift(ubig *dest, ubig *a, int x)
 {
-    zero_ubig(dest);
-
     // quotient and remainder of x being divided by 32
-    unsigned quotient = x >> 5, remainder = x & 0x1f;
+    int quotient = x >> 5, remainder = x & 0x1f;
+    int n = min(a->size, dest->size - quotient);
+    if (n <= 0) {
+        zero_ubig(dest);
+        return;
+    }
 
-    for (int i = 0; i + quotient < a->size; i++)
-        dest->cell[i + quotient] |= a->cell[i] << remainder;
+    limbs_lshift(dest->cell + quotient, a->cell, n, remainder);
+    memset(dest->cell, 0, quotient * sizeof(unsigned int));
+    memset(dest->cell + quotient + n, 0,
+           (dest->size - quotient - n) * sizeof(unsigned int));
+}
 
-    if (remainder)
-        for (int i = 1; i + quotient < a->size; i++)
-            dest->cell[i + quotient] |= a->cell[i - 1] >> (32 - remainder);
+/*
+ * dest += a << x in a single pass, truncated to the size of dest. a has at
+ * least as many cells as dest.
+ */
+static inline void ubig_add_lshift(ubig *dest, const ubig *a, int x)
+{
+    int quotient = x >> 5;
+    if (quotient < dest->size)
+        limbs_addlsh_n(dest->cell + quotient, a->cell, dest->size - quotient,
+                       x & 0x1f);
 }
 
-static inline void ubig_mul(ubig *dest,
-                            ubig *a,
-                            const ubig *b,
-                            ubig *shift_buf,
-                            ubig *add_buf)
+static inline int ubig_mul(ubig *dest,
+                           ubig *a,
+                           const ubig *b,
+                           struct fib_ctx *ctx)
 {
     zero_ubig(dest);
     int index = a->size - 1;
     while (index >= 0 && !b->cell[index])
         index--;
     if (index < 0)
-        return;
+        return 1;
 
     for (int i = index; i >= 0; i--) {
+        if (fib_checkpoint(ctx))
+            return 0;
         int bit_index = (i << 5) + 31;
         for (unsigned long long mask = 0x80000000ULL; mask; mask >>= 1) {
-            if (b->cell[i] & mask) {
-                zero_ubig(shift_buf);
-                zero_ubig(add_buf);
-
-                ubig_lshift(shift_buf, a, bit_index);
-                ubig_add(add_buf, dest, shift_buf);
-                ubig_assign(dest, add_buf);
-            }
+            if (b->cell[i] & mask)
+                ubig_add_lshift(dest, a, bit_index);
             bit_index--;
         }
     }
+    return 1;
+}
+
+/* workspace needed by fib_sequence(k) */
+static inline size_t fib_ws_bytes(long long k)
+{
+    return 6 * ubig_ws_bytes(estimate_size(k));
 }
 
 /**
  * fib_sequence() - Calculate the k-th Fibonacci number.
  * @k:     Index of the Fibonacci number to calculate.
+ * @next:  If not NULL, receives F(k + 1), which then needs a workspace of
+ *         fib_ws_bytes(k + 1) bytes. It lives in @ctx->ws as well.
+ * @ctx:   Computation context with a workspace of fib_ws_bytes(k) bytes.
  *
- * Return: The k-th Fibonacci number on success.
+ * Return: The k-th Fibonacci number on success, NULL with @ctx->err set
+ * otherwise. The result lives in @ctx->ws.
  */
-static ubig *fib_sequence(long long k)
+static ubig *fib_sequence(long long k, ubig **next, struct fib_ctx *ctx)
 {
     if (k <= 1LL) {
-        ubig *result = new_ubig(1);
-        if (!result)
+        ubig *result = new_ubig_ws(ctx->ws, 1);
+        if (!result || (next && !(*next = new_ubig_ws(ctx->ws, 1))))
             return NULL;
+        if (next)
+            (*next)->cell[0] = 1U;
         result->cell[0] = (unsigned int) k;
         return result;
     }
 
-    int sz = estimate_size(k);
-    ubig *a = new_ubig(sz);
-    ubig *b = new_ubig(sz);
-    ubig *tmp1 = new_ubig(sz);
-    ubig *tmp2 = new_ubig(sz);
-    ubig *t1 = new_ubig(sz);
-    ubig *t2 = new_ubig(sz);
-    ubig *mul_buf1 = new_ubig(sz);
-    ubig *mul_buf2 = new_ubig(sz);
-    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2 || !mul_buf1 || !mul_buf2) {
-        destroy_ubig(a);
-        destroy_ubig(b);
-        destroy_ubig(tmp1);
-        destroy_ubig(tmp2);
-        destroy_ubig(t1);
-        destroy_ubig(t2);
-        destroy_ubig(mul_buf1);
-        destroy_ubig(mul_buf2);
+    // F(k + 1) may take one more cell than F(k)
+    int sz = estimate_size(next ? k + 1 : k);
+    ubig *a = new_ubig_ws(ctx->ws, sz);
+    ubig *b = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp1 = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp2 = new_ubig_ws(ctx->ws, sz);
+    ubig *t1 = new_ubig_ws(ctx->ws, sz);
+    ubig *t2 = new_ubig_ws(ctx->ws, sz);
+    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2)
         return NULL;
-    }
     b->cell[0] = 1ULL;
 
-    for (unsigned int mask = 0x80000000U >> __builtin_clzll(k); mask;
-         mask >>= 1) {
-        ubig_lshift(tmp1, b, 1);                    // tmp1 = 2*b
-        ubig_sub(tmp2, tmp1, a);                    // tmp2 = 2*b - a
-        ubig_mul(t1, a, tmp2, mul_buf1, mul_buf2);  // t1 = a*(2*b - a)
+    int result = 1;
+    for (unsigned long long mask = 0x8000000000000000ULL >> __builtin_clzll(k);
+         mask; mask >>= 1) {
+        ubig_lshift(tmp1, b, 1);              // tmp1 = 2*b
+        ubig_sub(tmp2, tmp1, a);              // tmp2 = 2*b - a
+        result = ubig_mul(t1, a, tmp2, ctx);  // t1 = a*(2*b - a)
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp1, a, a, ctx);  // tmp1 = a^2
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp2, b, b, ctx);  // tmp2 = b^2
+        if (!result)
+            break;
 
-        ubig_mul(tmp1, a, a, mul_buf1, mul_buf2);  // tmp1 = a^2
-        ubig_mul(tmp2, b, b, mul_buf1, mul_buf2);  // tmp2 = b^2
-        ubig_add(t2, tmp1, tmp2);                  // t2 = a^2 + b^2
+        ubig_add(t2, tmp1, tmp2);  // t2 = a^2 + b^2
 
-        ubig_assign(a, t1);
-        ubig_assign(b, t2);
+        swap(a, t1);
+        swap(b, t2);
         if (k & mask) {
             ubig_add(t1, a, b);  // t1 = a + b
-            ubig_assign(a, b);
-            ubig_assign(b, t1);
+            swap(a, b);
+            swap(b, t1);
         }
     }
 
-    destroy_ubig(b);
-    destroy_ubig(tmp1);
-    destroy_ubig(tmp2);
-    destroy_ubig(t1);
-    destroy_ubig(t2);
-    destroy_ubig(mul_buf1);
-    destroy_ubig(mul_buf2);
-    return a;
+    if (result && next)
+        *next = b;
+    return result ? a : NULL;
 }
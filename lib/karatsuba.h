@@ -1,6 +1,10 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
 static inline int estimate_size(long long k)
 {
     if (k <= 43)
@@ -41,6 +45,27 @@ static inline void destroy_ubig(ubig *ptr)
     }
 }
 
+/* bytes of workspace taken by new_ubig_ws(ws, size) */
+static inline size_t ubig_ws_bytes(int size)
+{
+    return FIB_WS_ALIGN(sizeof(ubig)) +
+           FIB_WS_ALIGN(size * sizeof(unsigned int));
+}
+
+/* like new_ubig(), but carved from a workspace instead of the allocator */
+static inline ubig *new_ubig_ws(struct fib_ws *ws, int size)
+{
+    ubig *ptr = fib_ws_alloc(ws, sizeof(ubig));
+    unsigned int *cellptr = fib_ws_alloc(ws, size * sizeof(unsigned int));
+    if (!ptr || !cellptr)
+        return NULL;
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
 static inline void zero_ubig(ubig *x)
 {
     memset(x->cell, 0, x->size * sizeof(unsigned int));
@@ -57,86 +82,49 @@ static inline void ubig_assign(ubig *dest, ubig *src)
 // modify for a, b having different size
 static inline void ubig_add(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] + b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] += (dest->cell[i] < a->cell[i]);
+    limbs_add_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 // modified addition for karatsuba
 static inline void ubig_add_in_place(ubig *dest, ubig *src, int front, int end)
 {
-    int carry = 0, i = 0;
-    for (int j = front; j < end; i++, j++) {
-        unsigned int tmp = dest->cell[i] + src->cell[j] + carry;
-        carry = (tmp < dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
-
-    for (; i < dest->size; i++) {
-        unsigned int tmp = dest->cell[i] + carry;
-        carry = (tmp < dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
+    limbs_add(dest->cell, dest->cell, dest->size, src->cell + front,
+              end - front);
 }
 
 // modified addition for karatsuba
 static inline void ubig_add_in_place2(ubig *dest, int offset, ubig *src)
 {
-    int carry = 0, i = offset;
-    for (int j = 0; j < src->size; i++, j++) {
-        unsigned int tmp = dest->cell[i] + src->cell[j] + carry;
-        carry = (tmp < dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
-
-    for (; i < dest->size; i++) {
-        unsigned int tmp = dest->cell[i] + carry;
-        carry = (tmp < dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
+    limbs_add_at(dest->cell, dest->size, offset, src->cell, src->size);
 }
 
 static inline void ubig_sub(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] - b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] -= (dest->cell[i] > a->cell[i]);
+    limbs_sub_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 // modified substraction for karatsuba
 static inline void ubig_sub_in_place(ubig *dest, ubig *src, int front, int end)
 {
-    int carry = 0, i = 0;
-    for (int j = front; j < src->size && j < end; i++, j++) {
-        unsigned int tmp = dest->cell[i] - src->cell[j] - carry;
-        carry = (tmp > dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
-
-    for (; i < dest->size; i++) {
-        unsigned int tmp = dest->cell[i] - carry;
-        carry = (tmp > dest->cell[i]);
-        dest->cell[i] = tmp;
-    }
+    int n = min(end, src->size) - front;
+    if (n > 0)
+        limbs_sub(dest->cell, dest->cell, dest->size, src->cell + front, n);
 }
 
 static inline void ubig_lshift(ubig *dest, ubig *a, int x)
 {
-    zero_ubig(dest);
-
     // quotient and remainder of x being divided by 32
-    unsigned quotient = x >> 5, remainder = x & 0x1f;
-
-    for (int i = 0; i + quotient < a->size; i++)
-        dest->cell[i + quotient] |= a->cell[i] << remainder;
+    int quotient = x >> 5, remainder = x & 0x1f;
+    int n = min(a->size, dest->size - quotient);
+    if (n <= 0) {
+        zero_ubig(dest);
+        return;
+    }
 
-    if (remainder)
-        for (int i = 1; i + quotient < a->size; i++)
-            dest->cell[i + quotient] |= a->cell[i - 1] >> (32 - remainder);
+    limbs_lshift(dest->cell + quotient, a->cell, n, remainder);
+    memset(dest->cell, 0, quotient * sizeof(unsigned int));
+    memset(dest->cell + quotient + n, 0,
+           (dest->size - quotient - n) * sizeof(unsigned int));
 }
 
 static inline int ubig_msb_idx(const ubig *a)
@@ -147,10 +135,17 @@ static inline int ubig_msb_idx(const ubig *a)
     return msb_i;
 }
 
-int mul_recursive(ubig *dest, ubig *x, ubig *y, int front, int end)
+int mul_recursive(ubig *dest,
+                  ubig *x,
+                  ubig *y,
+                  int front,
+                  int end,
+                  struct fib_ctx *ctx)
 {
-    // termination 32 bit x 32 bit case
+    // termination 32 bit x 32 bit case, or both factors are zero
     int size = end - front;
+    if (size <= 0)
+        return 1;
     if (size == 1) {
         unsigned long long product =
             (unsigned long long) x->cell[front] * y->cell[front];
@@ -162,25 +157,28 @@ int mul_recursive(ubig *dest, ubig *x, ubig *y, int front, int end)
         return 1;
     }
 
+    // small products finish quickly, only check before large ones
+    if (size >= 32 && fib_checkpoint(ctx))
+        return 0;
+
     // dest = z2 * 2^(middle * 2) + z0 * 2^(front * 2)
     int half_size = size / 2;
     int middle = front + half_size;
     int result;
-    result = mul_recursive(dest, x, y, middle, end);
+    result = mul_recursive(dest, x, y, middle, end, ctx);
     if (!result)
         return 0;
-    result = mul_recursive(dest, x, y, front, middle);
+    result = mul_recursive(dest, x, y, front, middle, ctx);
     if (!result)
         return 0;
 
     // tmp1 = (x0 + x1) and tmp2 = (y0 + y1)
-    ubig *tmp1 = new_ubig(half_size + 2);
-    ubig *tmp2 = new_ubig(half_size + 2);
-    ubig *z1 = new_ubig((half_size + 2) * 2);
+    size_t mark = fib_ws_mark(ctx->ws);
+    ubig *tmp1 = new_ubig_ws(ctx->ws, half_size + 2);
+    ubig *tmp2 = new_ubig_ws(ctx->ws, half_size + 2);
+    ubig *z1 = new_ubig_ws(ctx->ws, (half_size + 2) * 2);
     if (!tmp1 || !tmp2 || !z1) {
-        destroy_ubig(tmp1);
-        destroy_ubig(tmp2);
-        destroy_ubig(z1);
+        fib_ws_release(ctx->ws, mark);
         return 0;
     }
     memcpy(tmp1->cell, x->cell + middle, (end - middle) * sizeof(unsigned int));
@@ -192,11 +190,9 @@ int mul_recursive(ubig *dest, ubig *x, ubig *y, int front, int end)
     int sz_1 = ubig_msb_idx(tmp1) + 1;
     int sz_2 = ubig_msb_idx(tmp2) + 1;
     int common_sz = sz_1 > sz_2 ? sz_1 : sz_2;
-    result = mul_recursive(z1, tmp1, tmp2, 0, common_sz);
-    destroy_ubig(tmp1);
-    destroy_ubig(tmp2);
+    result = mul_recursive(z1, tmp1, tmp2, 0, common_sz, ctx);
     if (!result) {
-        destroy_ubig(z1);
+        fib_ws_release(ctx->ws, mark);
         return 0;
     }
     ubig_sub_in_place(z1, dest, front * 2, front * 2 + half_size * 2);
@@ -205,11 +201,11 @@ int mul_recursive(ubig *dest, ubig *x, ubig *y, int front, int end)
 
     // dest = dest + z1 * 2^(front + middle)
     ubig_add_in_place2(dest, front * 2 + half_size, z1);
-    destroy_ubig(z1);
+    fib_ws_release(ctx->ws, mark);
     return 1;
 }
 
-int ubig_mul(ubig *dest, ubig *a, ubig *b)
+int ubig_mul(ubig *dest, ubig *a, ubig *b, struct fib_ctx *ctx)
 {
     zero_ubig(dest);
 
@@ -229,74 +225,72 @@ int ubig_mul(ubig *dest, ubig *a, ubig *b)
         return 1;
 
     int common_sz = sz_a > sz_b ? sz_a : sz_b;
-    return mul_recursive(dest, a, b, 0, common_sz);
+    return mul_recursive(dest, a, b, 0, common_sz, ctx);
 }
 
-static ubig *fib_sequence(long long k)
+/*
+ * workspace needed by fib_sequence(k): six numbers plus the scratch space
+ * of mul_recursive(), which stays below four times the operand size
+ */
+static inline size_t fib_ws_bytes(long long k)
+{
+    int sz = estimate_size(k);
+    return 6 * ubig_ws_bytes(sz) + ubig_ws_bytes(4 * sz) + PAGE_SIZE;
+}
+
+static ubig *fib_sequence(long long k, ubig **next, struct fib_ctx *ctx)
 {
     if (k <= 1LL) {
-        ubig *result = new_ubig(1);
-        if (!result)
+        ubig *result = new_ubig_ws(ctx->ws, 1);
+        if (!result || (next && !(*next = new_ubig_ws(ctx->ws, 1))))
             return NULL;
+        if (next)
+            (*next)->cell[0] = 1U;
         result->cell[0] = (unsigned long long) k;
         return result;
     }
 
-    int sz = estimate_size(k);
-    ubig *a = new_ubig(sz);
-    ubig *b = new_ubig(sz);
-    ubig *tmp1 = new_ubig(sz);
-    ubig *tmp2 = new_ubig(sz);
-    ubig *t1 = new_ubig(sz);
-    ubig *t2 = new_ubig(sz);
-    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2) {
-        destroy_ubig(a);
-        destroy_ubig(b);
-        destroy_ubig(tmp1);
-        destroy_ubig(tmp2);
-        destroy_ubig(t1);
-        destroy_ubig(t2);
+    // F(k + 1) may take one more cell than F(k)
+    int sz = estimate_size(next ? k + 1 : k);
+    ubig *a = new_ubig_ws(ctx->ws, sz);
+    ubig *b = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp1 = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp2 = new_ubig_ws(ctx->ws, sz);
+    ubig *t1 = new_ubig_ws(ctx->ws, sz);
+    ubig *t2 = new_ubig_ws(ctx->ws, sz);
+    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2)
         return NULL;
-    }
     b->cell[0] = 1U;
 
     int result = 1;
     for (unsigned long long mask = 0x8000000000000000ULL >> __builtin_clzll(k);
          mask; mask >>= 1) {
-        ubig_lshift(tmp1, b, 1);         // tmp1 = 2*b
-        ubig_sub(tmp2, tmp1, a);         // tmp2 = 2*b - a
-        result = ubig_mul(t1, a, tmp2);  // t1 = a*(2*b - a)
+        ubig_lshift(tmp1, b, 1);              // tmp1 = 2*b
+        ubig_sub(tmp2, tmp1, a);              // tmp2 = 2*b - a
+        result = ubig_mul(t1, a, tmp2, ctx);  // t1 = a*(2*b - a)
         if (!result)
             break;
 
-        result = ubig_mul(tmp1, a, a);  // tmp1 = a^2
+        result = ubig_mul(tmp1, a, a, ctx);  // tmp1 = a^2
         if (!result)
             break;
 
-        result = ubig_mul(tmp2, b, b);  // tmp2 = b^2
+        result = ubig_mul(tmp2, b, b, ctx);  // tmp2 = b^2
         if (!result)
             break;
 
         ubig_add(t2, tmp1, tmp2);  // t2 = a^2 + b^2
 
-        ubig_assign(a, t1);
-        ubig_assign(b, t2);
+        swap(a, t1);
+        swap(b, t2);
         if (k & mask) {
             ubig_add(t1, a, b);  // t1 = a + b
-            ubig_assign(a, b);
-            ubig_assign(b, t1);
+            swap(a, b);
+            swap(b, t1);
         }
     }
 
-    if (!result) {
-        destroy_ubig(a);
-        a = NULL;
-    }
-
-    destroy_ubig(b);
-    destroy_ubig(tmp1);
-    destroy_ubig(tmp2);
-    destroy_ubig(t1);
-    destroy_ubig(t2);
-    return a;
+    if (result && next)
+        *next = b;
+    return result ? a : NULL;
 }
\ No newline at end of file
@@ -0,0 +1,772 @@
+#ifndef FIB_LIMBS_H
+#define FIB_LIMBS_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+
+/*
+ * Arithmetic on raw little-endian arrays of 32-bit limbs. Unlike ubig,
+ * operands carry their length explicitly, so products can recurse on
+ * slices of their inputs and the functions can be combined into a
+ * multiplier hierarchy:
+ *
+ *   limbs_mul_basecase()   O(n^2)      below limbs_karatsuba_threshold
+ *   limbs_mul_karatsuba()  O(n^1.585)  below limbs_toom3_threshold
+ *   limbs_mul_toom3()      O(n^1.465)  above
+ *
+ * limbs_mul_n() and limbs_sqr_n() pick the level by operand length. All
+ * recursive levels take their temporaries from a caller-provided scratch
+ * area of limbs_mul_scratch(n) limbs.
+ */
+
+/* crossovers in limbs used until limbs_tune() is called */
+#define KARATSUBA_THRESHOLD 32
+#define TOOM3_THRESHOLD 128
+
+/* smallest operands the recursive levels can split */
+#define KARATSUBA_MIN 2
+#define TOOM3_MIN 5
+
+static int limbs_karatsuba_threshold = KARATSUBA_THRESHOLD;
+static int limbs_toom3_threshold = TOOM3_THRESHOLD;
+
+/* r[0..n) = a + b, return the carry out */
+static inline unsigned int limbs_add_n(unsigned int *r,
+                                       const unsigned int *a,
+                                       const unsigned int *b,
+                                       int n)
+{
+    unsigned long long t = 0;
+    for (int i = 0; i < n; i++) {
+        t += (unsigned long long) a[i] + b[i];
+        r[i] = t;
+        t >>= 32;
+    }
+    return t;
+}
+
+/* r[0..n) = a - b, return the borrow out */
+static inline unsigned int limbs_sub_n(unsigned int *r,
+                                       const unsigned int *a,
+                                       const unsigned int *b,
+                                       int n)
+{
+    unsigned int borrow = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned long long t = (unsigned long long) a[i] - b[i] - borrow;
+        r[i] = t;
+        borrow = (t >> 32) & 1;
+    }
+    return borrow;
+}
+
+/* r[0..an) = a[0..an) + b[0..bn) with an >= bn, return the carry out */
+static inline unsigned int limbs_add(unsigned int *r,
+                                     const unsigned int *a,
+                                     int an,
+                                     const unsigned int *b,
+                                     int bn)
+{
+    unsigned int carry = limbs_add_n(r, a, b, bn);
+    for (int i = bn; i < an; i++) {
+        r[i] = a[i] + carry;
+        carry = carry && !r[i];
+    }
+    return carry;
+}
+
+/* r[0..an) = a[0..an) - b[0..bn) with an >= bn, return the borrow out */
+static inline unsigned int limbs_sub(unsigned int *r,
+                                     const unsigned int *a,
+                                     int an,
+                                     const unsigned int *b,
+                                     int bn)
+{
+    unsigned int borrow = limbs_sub_n(r, a, b, bn);
+    for (int i = bn; i < an; i++) {
+        unsigned int x = a[i];
+        r[i] = x - borrow;
+        borrow = borrow && !x;
+    }
+    return borrow;
+}
+
+/* compare a and b of n limbs each, return -1, 0 or 1 */
+static inline int limbs_cmp(const unsigned int *a, const unsigned int *b, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        if (a[i] != b[i])
+            return a[i] > b[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+/*
+ * r[0..n) = |a - b|, return 1 when a < b. r may alias a or b.
+ */
+static inline int limbs_diff_n(unsigned int *r,
+                               const unsigned int *a,
+                               const unsigned int *b,
+                               int n)
+{
+    if (limbs_cmp(a, b, n) < 0) {
+        limbs_sub_n(r, b, a, n);
+        return 1;
+    }
+    limbs_sub_n(r, a, b, n);
+    return 0;
+}
+
+/* add x[0..xn) into r[off..rn), the carry runs up to the top of r */
+static inline void limbs_add_at(unsigned int *r,
+                                int rn,
+                                int off,
+                                const unsigned int *x,
+                                int xn)
+{
+    if (xn > rn - off)
+        xn = rn - off;  // the limbs cut off are zero
+    limbs_add(r + off, r + off, rn - off, x, xn);
+}
+
+/* r[0..n) = a >> 1 */
+static inline void limbs_rshift1(unsigned int *r, const unsigned int *a, int n)
+{
+    for (int i = 0; i < n - 1; i++)
+        r[i] = (a[i] >> 1) | (a[i + 1] << 31);
+    r[n - 1] = a[n - 1] >> 1;
+}
+
+/*
+ * r[0..n) = a << shift for 0 <= shift < 32, return the bits shifted out.
+ * Walks downwards, so r may alias a.
+ */
+static inline unsigned int limbs_lshift(unsigned int *r,
+                                        const unsigned int *a,
+                                        int n,
+                                        unsigned int shift)
+{
+    if (!shift) {
+        memmove(r, a, n * sizeof(unsigned int));
+        return 0;
+    }
+
+    unsigned int out = a[n - 1] >> (32 - shift);
+    for (int i = n - 1; i > 0; i--)
+        r[i] = (a[i] << shift) | (a[i - 1] >> (32 - shift));
+    r[0] = a[0] << shift;
+    return out;
+}
+
+/*
+ * r[0..n) += a[0..n) << shift for 0 <= shift < 32 in a single pass, the
+ * bits shifted beyond r are dropped. Return the carry out.
+ */
+static inline unsigned int limbs_addlsh_n(unsigned int *r,
+                                          const unsigned int *a,
+                                          int n,
+                                          unsigned int shift)
+{
+    unsigned long long t = 0;
+    unsigned int low = 0;  // bits carried into the next limb by the shift
+    for (int i = 0; i < n; i++) {
+        unsigned int x = shift ? (a[i] << shift) | low : a[i];
+        low = shift ? a[i] >> (32 - shift) : 0;
+        t += (unsigned long long) r[i] + x;
+        r[i] = t;
+        t >>= 32;
+    }
+    return t;
+}
+
+/* r[0..n) = a * c, return the limb carried out */
+static inline unsigned int limbs_mul_1(unsigned int *r,
+                                       const unsigned int *a,
+                                       int n,
+                                       unsigned int c)
+{
+    unsigned long long t = 0;
+    for (int i = 0; i < n; i++) {
+        t += (unsigned long long) a[i] * c;
+        r[i] = t;
+        t >>= 32;
+    }
+    return t;
+}
+
+/* r[0..n) += a * c, return the limb carried out */
+static inline unsigned int limbs_addmul_1(unsigned int *r,
+                                          const unsigned int *a,
+                                          int n,
+                                          unsigned int c)
+{
+    unsigned long long t = 0;
+    for (int i = 0; i < n; i++) {
+        t += (unsigned long long) a[i] * c + r[i];
+        r[i] = t;
+        t >>= 32;
+    }
+    return t;
+}
+
+/* a[0..n) /= d in place, return the remainder */
+static inline unsigned int limbs_divmod_1(unsigned int *a,
+                                          int n,
+                                          unsigned int d)
+{
+    unsigned int rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        u64 t = ((u64) rem << 32) | a[i];
+        rem = do_div(t, d);
+        a[i] = t;
+    }
+    return rem;
+}
+
+/* bytes limbs_get_str() may write for an n-limb number */
+static inline size_t limbs_str_size(int n)
+{
+    return 10 * (size_t) n + 9;  // a limb has less than 10 decimal digits
+}
+
+/**
+ * limbs_get_str() - Convert a number into decimal ASCII digits.
+ * @str: Buffer of limbs_str_size(@n) bytes, receives the digits without a
+ *       terminating NUL.
+ * @a:   The number, destroyed by the conversion.
+ * @n:   Number of limbs of @a.
+ *
+ * Peels off nine digits at a time by dividing by 10^9, so the cost is
+ * quadratic in @n.
+ *
+ * Return: Number of digits, at least one.
+ */
+static size_t limbs_get_str(char *str, unsigned int *a, int n)
+{
+    size_t size = limbs_str_size(n), pos = size;
+
+    while (n > 0 && !a[n - 1])
+        n--;
+    while (n > 0) {
+        unsigned int chunk = limbs_divmod_1(a, n, 1000000000U);
+        for (int i = 0; i < 9; i++) {
+            str[--pos] = '0' + chunk % 10;
+            chunk /= 10;
+        }
+        while (n > 0 && !a[n - 1])
+            n--;
+        cond_resched();
+    }
+
+    // strip the zeros of the leading chunk and move the digits to the front
+    while (pos < size - 1 && str[pos] == '0')
+        pos++;
+    if (pos == size)
+        str[--pos] = '0';
+    memmove(str, str + pos, size - pos);
+    return size - pos;
+}
+
+/*
+ * r[0..n) = a / 3 for an a known to be a multiple of 3. Walks upwards
+ * multiplying by the inverse of 3 modulo 2^32, so no division is needed.
+ */
+static inline void limbs_divexact_3(unsigned int *r,
+                                    const unsigned int *a,
+                                    int n)
+{
+    const unsigned int inverse = 0xAAAAAAABU;  // 3 * inverse == 1 mod 2^32
+    unsigned int borrow = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int x = a[i] - borrow;
+        unsigned int q = x * inverse;
+        borrow = (((unsigned long long) q * 3) >> 32) + (a[i] < borrow);
+        r[i] = q;
+    }
+}
+
+/* r[0..an+bn) = a[0..an) * b[0..bn), r must not overlap the operands */
+static inline void limbs_mul_basecase(unsigned int *r,
+                                      const unsigned int *a,
+                                      int an,
+                                      const unsigned int *b,
+                                      int bn)
+{
+    memset(r, 0, (an + bn) * sizeof(unsigned int));
+    for (int i = 0; i < bn; i++) {
+        unsigned long long t = 0;
+        for (int j = 0; j < an; j++) {
+            t += (unsigned long long) a[j] * b[i] + r[i + j];
+            r[i + j] = t;
+            t >>= 32;
+        }
+        r[i + an] = t;
+    }
+}
+
+/* r[0..2n) = a^2, computing every cross product only once */
+static inline void limbs_sqr_basecase(unsigned int *r,
+                                      const unsigned int *a,
+                                      int n)
+{
+    memset(r, 0, 2 * n * sizeof(unsigned int));
+
+    // r = sum of a[i] * a[j] for i < j
+    for (int i = 0; i < n - 1; i++) {
+        unsigned long long t = 0;
+        for (int j = i + 1; j < n; j++) {
+            t += (unsigned long long) a[i] * a[j] + r[i + j];
+            r[i + j] = t;
+            t >>= 32;
+        }
+        r[i + n] = t;
+    }
+
+    // r = 2 * r + sum of a[i]^2
+    unsigned int top = 0;
+    for (int i = 0; i < 2 * n; i++) {
+        unsigned int bit = r[i] >> 31;
+        r[i] = (r[i] << 1) | top;
+        top = bit;
+    }
+    unsigned long long t = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned long long sq = (unsigned long long) a[i] * a[i];
+        t += (unsigned long long) r[2 * i] + (unsigned int) sq;
+        r[2 * i] = t;
+        t >>= 32;
+        t += (unsigned long long) r[2 * i + 1] + (sq >> 32);
+        r[2 * i + 1] = t;
+        t >>= 32;
+    }
+}
+
+static void limbs_mul_n(unsigned int *r,
+                        const unsigned int *a,
+                        const unsigned int *b,
+                        int n,
+                        unsigned int *scratch);
+static void limbs_sqr_n(unsigned int *r,
+                        const unsigned int *a,
+                        int n,
+                        unsigned int *scratch);
+
+/**
+ * limbs_mul_karatsuba() - Multiply two n-limb numbers with Karatsuba.
+ * @r:       Result of 2 * @n limbs, must not overlap the operands.
+ * @a:       First operand.
+ * @b:       Second operand, may be equal to @a for squaring.
+ * @n:       Number of limbs of each operand, at least 2.
+ * @scratch: limbs_mul_scratch(@n) limbs of temporary space.
+ *
+ * Uses the subtractive form z1 = z0 + z2 - (a0 - a1)(b0 - b1), so the
+ * half-size products never grow a carry limb.
+ */
+static void limbs_mul_karatsuba(unsigned int *r,
+                                const unsigned int *a,
+                                const unsigned int *b,
+                                int n,
+                                unsigned int *scratch)
+{
+    int l = n / 2, h = n - l;  // low and high halves, h >= l
+    unsigned int *da = scratch;
+    unsigned int *db = da + h;
+    unsigned int *dm = db + h;
+    unsigned int *t = dm + 2 * h;
+    unsigned int *next = t + 2 * h + 1;
+    bool sqr = a == b;
+
+    // z0 = a0 * b0 in r[0..2l), z2 = a1 * b1 in r[2l..2n)
+    if (sqr) {
+        limbs_sqr_n(r, a, l, next);
+        limbs_sqr_n(r + 2 * l, a + l, h, next);
+    } else {
+        limbs_mul_n(r, a, b, l, next);
+        limbs_mul_n(r + 2 * l, a + l, b + l, h, next);
+    }
+
+    // dm = |a0 - a1| * |b0 - b1|, with a0 and b0 padded to h limbs
+    int neg = 0;
+    memset(da, 0, 2 * h * sizeof(unsigned int));
+    memcpy(da, a, l * sizeof(unsigned int));
+    neg ^= limbs_diff_n(da, da, a + l, h);
+    if (sqr) {
+        neg = 0;  // a square is never negative
+        limbs_sqr_n(dm, da, h, next);
+    } else {
+        memcpy(db, b, l * sizeof(unsigned int));
+        neg ^= limbs_diff_n(db, db, b + l, h);
+        limbs_mul_n(dm, da, db, h, next);
+    }
+
+    // t = z0 + z2 -/+ dm, then r += t * 2^(32 * l)
+    memset(t, 0, (2 * h + 1) * sizeof(unsigned int));
+    memcpy(t, r, 2 * l * sizeof(unsigned int));
+    t[2 * h] = limbs_add_n(t, t, r + 2 * l, 2 * h);
+    if (neg)
+        limbs_add(t, t, 2 * h + 1, dm, 2 * h);
+    else
+        limbs_sub(t, t, 2 * h + 1, dm, 2 * h);
+    limbs_add_at(r, 2 * n, l, t, 2 * h + 1);
+}
+
+/*
+ * Interpolation shared by limbs_mul_toom3() and limbs_sqr_toom3(). On entry
+ * r holds v0 in r[0..2k) and vinf in r[4k..2n), and the m = 2k + 2 limb
+ * buffers hold v1, |vm1| and v2. Follows Bodrato's sequence, in which only
+ * vm1 can be negative and every division is exact.
+ */
+static void limbs_toom3_interpolate(unsigned int *r,
+                                    int n,
+                                    int k,
+                                    unsigned int *v1,
+                                    unsigned int *vm1,
+                                    int vm1_neg,
+                                    unsigned int *v2)
+{
+    int m = 2 * k + 2, s2 = 2 * (n - 2 * k);
+    const unsigned int *v0 = r, *vinf = r + 4 * k;
+
+    // r3 = (v2 - vm1) / 3
+    if (vm1_neg)
+        limbs_add_n(v2, v2, vm1, m);
+    else
+        limbs_sub_n(v2, v2, vm1, m);
+    limbs_divexact_3(v2, v2, m);
+
+    // r1 = (v1 - vm1) / 2
+    if (vm1_neg)
+        limbs_add_n(vm1, v1, vm1, m);
+    else
+        limbs_sub_n(vm1, v1, vm1, m);
+    limbs_rshift1(vm1, vm1, m);
+
+    // r2 = v1 - v0
+    limbs_sub(v1, v1, m, v0, 2 * k);
+
+    // r3 = (r3 - r2) / 2
+    limbs_sub_n(v2, v2, v1, m);
+    limbs_rshift1(v2, v2, m);
+
+    // r2 = r2 - r1 - vinf
+    limbs_sub_n(v1, v1, vm1, m);
+    limbs_sub(v1, v1, m, vinf, s2);
+
+    // r3 = r3 - 2 * vinf
+    limbs_sub(v2, v2, m, vinf, s2);
+    limbs_sub(v2, v2, m, vinf, s2);
+
+    // r1 = r1 - r3
+    limbs_sub_n(vm1, vm1, v2, m);
+
+    // r = v0 + r1 x + r2 x^2 + r3 x^3 + vinf x^4, x = 2^(32 * k)
+    memset(r + 2 * k, 0, 2 * k * sizeof(unsigned int));
+    limbs_add_at(r, 2 * n, k, vm1, m);
+    limbs_add_at(r, 2 * n, 2 * k, v1, m);
+    limbs_add_at(r, 2 * n, 3 * k, v2, m);
+}
+
+/* e[0..k] = x0 + x1 + x2 and em[0..k] = |x0 - x1 + x2|, return the sign */
+static int limbs_toom3_eval_1(unsigned int *e,
+                              unsigned int *em,
+                              const unsigned int *x,
+                              int k,
+                              int s)
+{
+    e[k] = limbs_add(e, x, k, x + 2 * k, s);  // x0 + x2
+    memcpy(em, x + k, k * sizeof(unsigned int));
+    em[k] = 0;
+    int neg = limbs_diff_n(em, e, em, k + 1);  // |x0 + x2 - x1|
+    e[k] += limbs_add_n(e, e, x + k, k);       // x0 + x1 + x2
+    return neg;
+}
+
+/* e[0..k] = x0 + 2 x1 + 4 x2 */
+static void limbs_toom3_eval_2(unsigned int *e,
+                               const unsigned int *x,
+                               int k,
+                               int s)
+{
+    // ((x2 * 2 + x1) * 2) + x0, on k + 1 limbs
+    memset(e, 0, (k + 1) * sizeof(unsigned int));
+    memcpy(e, x + 2 * k, s * sizeof(unsigned int));
+    limbs_add_n(e, e, e, k + 1);
+    limbs_add(e, e, k + 1, x + k, k);
+    limbs_add_n(e, e, e, k + 1);
+    limbs_add(e, e, k + 1, x, k);
+}
+
+/**
+ * limbs_mul_toom3() - Multiply two n-limb numbers with Toom-Cook 3-way.
+ * @r:       Result of 2 * @n limbs, must not overlap the operands.
+ * @a:       First operand.
+ * @b:       Second operand.
+ * @n:       Number of limbs of each operand, at least 5.
+ * @scratch: limbs_mul_scratch(@n) limbs of temporary space.
+ *
+ * Splits both operands into three pieces of k = ceil(n / 3) limbs and
+ * evaluates at 0, 1, -1, 2 and infinity, so five products of k + 1 limbs
+ * replace the nine of the schoolbook method.
+ */
+static void limbs_mul_toom3(unsigned int *r,
+                            const unsigned int *a,
+                            const unsigned int *b,
+                            int n,
+                            unsigned int *scratch)
+{
+    int k = (n + 2) / 3, s = n - 2 * k, m = 2 * k + 2;
+    unsigned int *v1 = scratch;
+    unsigned int *vm1 = v1 + m;
+    unsigned int *v2 = vm1 + m;
+    unsigned int *ea = v2 + m;
+    unsigned int *eb = ea + (k + 1);
+    unsigned int *ema = eb + (k + 1);
+    unsigned int *emb = ema + (k + 1);
+    unsigned int *next = emb + (k + 1);
+
+    if (n >= 256)
+        cond_resched();
+
+    // v1 = a(1) * b(1), vm1 = |a(-1) * b(-1)|
+    int neg = limbs_toom3_eval_1(ea, ema, a, k, s);
+    neg ^= limbs_toom3_eval_1(eb, emb, b, k, s);
+    limbs_mul_n(v1, ea, eb, k + 1, next);
+    limbs_mul_n(vm1, ema, emb, k + 1, next);
+
+    // v2 = a(2) * b(2)
+    limbs_toom3_eval_2(ea, a, k, s);
+    limbs_toom3_eval_2(eb, b, k, s);
+    limbs_mul_n(v2, ea, eb, k + 1, next);
+
+    // v0 = a0 * b0, vinf = a2 * b2, both straight into r
+    limbs_mul_n(r, a, b, k, next);
+    limbs_mul_n(r + 4 * k, a + 2 * k, b + 2 * k, s, next);
+
+    limbs_toom3_interpolate(r, n, k, v1, vm1, neg, v2);
+}
+
+/**
+ * limbs_sqr_toom3() - Square an n-limb number with Toom-Cook 3-way.
+ * @r:       Result of 2 * @n limbs, must not overlap the operand.
+ * @a:       Operand.
+ * @n:       Number of limbs of @a, at least 5.
+ * @scratch: limbs_mul_scratch(@n) limbs of temporary space.
+ *
+ * Same as limbs_mul_toom3(), but every point is squared, so there is one
+ * evaluation per point and vm1 is never negative.
+ */
+static void limbs_sqr_toom3(unsigned int *r,
+                            const unsigned int *a,
+                            int n,
+                            unsigned int *scratch)
+{
+    int k = (n + 2) / 3, s = n - 2 * k, m = 2 * k + 2;
+    unsigned int *v1 = scratch;
+    unsigned int *vm1 = v1 + m;
+    unsigned int *v2 = vm1 + m;
+    unsigned int *ea = v2 + m;
+    unsigned int *ema = ea + (k + 1);
+    unsigned int *next = ema + 3 * (k + 1);
+
+    if (n >= 256)
+        cond_resched();
+
+    limbs_toom3_eval_1(ea, ema, a, k, s);
+    limbs_sqr_n(v1, ea, k + 1, next);
+    limbs_sqr_n(vm1, ema, k + 1, next);
+
+    limbs_toom3_eval_2(ea, a, k, s);
+    limbs_sqr_n(v2, ea, k + 1, next);
+
+    limbs_sqr_n(r, a, k, next);
+    limbs_sqr_n(r + 4 * k, a + 2 * k, s, next);
+
+    limbs_toom3_interpolate(r, n, k, v1, vm1, 0, v2);
+}
+
+/**
+ * limbs_mul_scratch() - Scratch space needed by limbs_mul_n(n).
+ * @n: Number of limbs of each operand.
+ *
+ * Mirrors the choice of limbs_mul_n() level by level. Crossing a threshold
+ * can make a smaller product need more space than a larger one, so every
+ * sub-product size is considered, and the result is rounded up to keep it
+ * non-decreasing in @n: space for the longest product also covers shorter
+ * ones. Squaring never needs more than multiplication.
+ *
+ * Return: Number of limbs.
+ */
+static size_t limbs_mul_scratch(int n)
+{
+    if (n < limbs_karatsuba_threshold)
+        return 0;
+
+    if (n < limbs_toom3_threshold) {
+        int l = n / 2, h = n - l;
+        return 6 * h + 1 +
+               max(limbs_mul_scratch(h), limbs_mul_scratch(l));
+    }
+
+    int k = (n + 2) / 3, s = n - 2 * k;
+    size_t sub = max(limbs_mul_scratch(k + 1), limbs_mul_scratch(k));
+    size_t toom =
+        3 * (2 * k + 2) + 4 * (k + 1) + max(sub, limbs_mul_scratch(s));
+    return max(toom, limbs_mul_scratch(limbs_toom3_threshold - 1));
+}
+
+/* r[0..2n) = a * b, picking the algorithm by operand length */
+static void limbs_mul_n(unsigned int *r,
+                        const unsigned int *a,
+                        const unsigned int *b,
+                        int n,
+                        unsigned int *scratch)
+{
+    if (n < limbs_karatsuba_threshold)
+        limbs_mul_basecase(r, a, n, b, n);
+    else if (n < limbs_toom3_threshold)
+        limbs_mul_karatsuba(r, a, b, n, scratch);
+    else
+        limbs_mul_toom3(r, a, b, n, scratch);
+}
+
+/* r[0..2n) = a^2, picking the algorithm by operand length */
+static void limbs_sqr_n(unsigned int *r,
+                        const unsigned int *a,
+                        int n,
+                        unsigned int *scratch)
+{
+    if (n < limbs_karatsuba_threshold)
+        limbs_sqr_basecase(r, a, n);
+    else if (n < limbs_toom3_threshold)
+        limbs_mul_karatsuba(r, a, a, n, scratch);
+    else
+        limbs_sqr_toom3(r, a, n, scratch);
+}
+
+/* largest operand tried by limbs_tune() and the runs timed per size */
+#define LIMBS_TUNE_MAX 512
+#define LIMBS_TUNE_RUNS 5
+
+typedef void (*limbs_mul_fn)(unsigned int *r,
+                             const unsigned int *a,
+                             const unsigned int *b,
+                             int n,
+                             unsigned int *scratch);
+
+static void limbs_mul_basecase_n(unsigned int *r,
+                                 const unsigned int *a,
+                                 const unsigned int *b,
+                                 int n,
+                                 unsigned int *scratch)
+{
+    limbs_mul_basecase(r, a, n, b, n);
+}
+
+/* nanoseconds of the fastest of LIMBS_TUNE_RUNS batches of products */
+static u64 limbs_time(limbs_mul_fn mul,
+                      unsigned int *r,
+                      const unsigned int *a,
+                      const unsigned int *b,
+                      int n,
+                      unsigned int *scratch)
+{
+    int reps = max(1, 4096 / n);
+    u64 best = U64_MAX;
+
+    for (int run = 0; run < LIMBS_TUNE_RUNS; run++) {
+        u64 start = ktime_get_ns();
+        for (int i = 0; i < reps; i++)
+            mul(r, a, b, n, scratch);
+        best = min(best, ktime_get_ns() - start);
+    }
+    return best;
+}
+
+/*
+ * Smallest n in [lo, hi] from which fast beats slow at two sizes in a row,
+ * stepping by step, so one noisy measurement does not decide. The
+ * threshold being searched is set to n first, so the sub-products of fast
+ * already fall back to the lower levels.
+ */
+static int limbs_crossover(limbs_mul_fn slow,
+                           limbs_mul_fn fast,
+                           int *threshold,
+                           int lo,
+                           int hi,
+                           int step,
+                           unsigned int *buf)
+{
+    unsigned int *a = buf, *b = a + hi, *r = b + hi, *scratch = r + 2 * hi;
+    int first = 0;
+
+    for (int n = lo; n < hi; n += step) {
+        *threshold = n;
+        if (limbs_time(fast, r, a, b, n, scratch) <
+            limbs_time(slow, r, a, b, n, scratch)) {
+            if (first)
+                return first;
+            first = n;
+        } else {
+            first = 0;
+        }
+        cond_resched();
+    }
+    return hi;
+}
+
+/**
+ * limbs_tune() - Set the crossovers of limbs_mul_n() and limbs_sqr_n().
+ * @karatsuba: Operand limbs from which Karatsuba is used, 0 to measure.
+ * @toom3:     Operand limbs from which Toom-3 is used, 0 to measure.
+ *
+ * Thresholds left at 0 are found by timing both neighbouring levels on
+ * random operands of growing length, which takes a few tens of
+ * milliseconds. The thresholds decide limbs_mul_scratch(), so this has to
+ * run before any multiplication.
+ *
+ * Return: 0, or -ENOMEM if there was no memory for the measurement.
+ */
+static int limbs_tune(unsigned int karatsuba, unsigned int toom3)
+{
+    unsigned int *buf = NULL;
+    int n = LIMBS_TUNE_MAX;
+
+    if (!karatsuba || !toom3) {
+        // operands, product, and scratch of at most 8 n limbs at any level
+        buf = kmalloc_array(12 * n + 256, sizeof(unsigned int), GFP_KERNEL);
+        if (!buf)
+            return -ENOMEM;
+        get_random_bytes(buf, 2 * n * sizeof(unsigned int));
+    }
+
+    if (karatsuba) {
+        limbs_karatsuba_threshold =
+            clamp_t(unsigned int, karatsuba, KARATSUBA_MIN, INT_MAX);
+    } else {
+        limbs_toom3_threshold = INT_MAX;
+        limbs_karatsuba_threshold =
+            limbs_crossover(limbs_mul_basecase_n, limbs_mul_karatsuba,
+                            &limbs_karatsuba_threshold, 8, 128, 4, buf);
+    }
+
+    if (toom3) {
+        limbs_toom3_threshold =
+            clamp_t(unsigned int, toom3, TOOM3_MIN, INT_MAX);
+    } else {
+        limbs_toom3_threshold =
+            limbs_crossover(limbs_mul_karatsuba, limbs_mul_toom3,
+                            &limbs_toom3_threshold,
+                            max(limbs_karatsuba_threshold, 16), n, 8, buf);
+    }
+
+    kfree(buf);
+    return 0;
+}
+
+#endif /* FIB_LIMBS_H */
@@ -0,0 +1,208 @@
+#ifndef FIB_RECURRENCE_H
+#define FIB_RECURRENCE_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
+/*
+ * Constant-coefficient linear recurrences
+ *
+ *   a(n) = c[0] a(n - 1) + c[1] a(n - 2) + ... + c[d - 1] a(n - d)
+ *
+ * with given a(0)..a(d - 1), evaluated by Fiduccia's method: with the
+ * characteristic polynomial P(x) = x^d - c[0] x^(d - 1) - ... - c[d - 1],
+ * x^k mod P(x) = r[0] + r[1] x + ... + r[d - 1] x^(d - 1) gives
+ * a(k) = r[0] a(0) + ... + r[d - 1] a(d - 1). The remainder is found by
+ * square-and-multiply on polynomials, so a(k) takes O(d^2 M(n) log k).
+ * For Fibonacci (d = 2) that is three products per bit of k, like fast
+ * doubling.
+ *
+ * Coefficients and initial terms are unsigned 32-bit integers, so every
+ * intermediate value is non-negative and fits the limb arithmetic.
+ */
+
+#define REC_MAX_ORDER 8
+
+/* largest result rec_eval() agrees to compute, in 32-bit cells */
+#define REC_MAX_CELLS 16384
+
+/* upper bound of log2(x) for x >= 1, in 16.16 fixed point */
+static u32 rec_log2(u64 x)
+{
+    int n = fls64(x) - 1;
+    u64 m = x << (63 - n);  // mantissa in [1, 2) scaled by 2^63
+    u32 frac = 0;
+
+    // each squaring of the mantissa yields one more fraction bit
+    for (int i = 15; i >= 0; i--) {
+        u64 t = (m >> 32) * (m >> 32);  // in [1, 4) scaled by 2^62
+        if (t >> 63) {
+            frac |= 1U << i;
+            m = t;
+        } else {
+            m = t << 1;
+        }
+    }
+    return (n << 16) + frac + 2;  // round up past the truncated mantissa
+}
+
+/**
+ * rec_cells() - Size of the numbers rec_eval() works with.
+ * @order: Order d of the recurrence, 1..REC_MAX_ORDER.
+ * @coef:  The d coefficients.
+ * @k:     Index of the wanted term.
+ *
+ * With S the sum of the coefficients, every term is below
+ * d * 2^32 * max(S, 1)^k, and so is every coefficient of x^k mod P(x).
+ *
+ * Return: Number of cells, or 0 if that exceeds REC_MAX_CELLS.
+ */
+static int rec_cells(int order, const u32 *coef, u64 k)
+{
+    u64 sum = 0, bits = 32 + 3;
+
+    for (int i = 0; i < order; i++)
+        sum += coef[i];
+    if (sum >= 2) {
+        if (k > (u64) REC_MAX_CELLS * 32)  // a term grows by at least a bit
+            return 0;
+        bits += (k * rec_log2(sum) >> 16) + 1;
+    }
+
+    u64 cells = (bits + 31) / 32 + 1;
+    return cells > REC_MAX_CELLS ? 0 : cells;
+}
+
+/* number of t buffers, x^k mod P(x) squared has degree 2d - 2 */
+#define REC_T_COUNT(d) (2 * (d) - 1)
+#define REC_T_CELLS(d, cells) (2 * (cells) + (d) + 2)
+
+/* limbs used by rec_eval(): r(x), t(x), a product and its scratch space */
+static inline size_t rec_limbs(int order, int cells)
+{
+    return (size_t) order * cells +
+           REC_T_COUNT(order) * REC_T_CELLS(order, cells) + 2 * cells +
+           limbs_mul_scratch(cells);
+}
+
+/* workspace needed by rec_eval() */
+static inline size_t rec_ws_bytes(int order, int cells)
+{
+    return FIB_WS_ALIGN(rec_limbs(order, cells) * sizeof(unsigned int));
+}
+
+/* used length of x, 0 for zero */
+static inline int rec_len(const unsigned int *x, int n)
+{
+    while (n > 0 && !x[n - 1])
+        n--;
+    return n;
+}
+
+/**
+ * rec_eval() - Evaluate a linear recurrence at index k.
+ * @out:   Receives a(@k) in @cells cells.
+ * @cells: rec_cells() of the recurrence and @k.
+ * @order: Order d of the recurrence, 1..REC_MAX_ORDER.
+ * @coef:  The d coefficients, @coef[i] multiplies a(n - 1 - i).
+ * @init:  The initial terms a(0)..a(d - 1).
+ * @k:     Index of the wanted term.
+ * @ctx:   Computation context with a workspace of rec_ws_bytes() bytes.
+ *
+ * Return: 0 on success, or the negative errno fib_checkpoint() reported.
+ */
+static int rec_eval(unsigned int *out,
+                    int cells,
+                    int order,
+                    const u32 *coef,
+                    const u32 *init,
+                    u64 k,
+                    struct fib_ctx *ctx)
+{
+    int d = order, tn = REC_T_CELLS(d, cells);
+    unsigned int *r[REC_MAX_ORDER], *t[REC_T_COUNT(REC_MAX_ORDER)];
+    unsigned int *mem, *prod, *scratch;
+
+    mem = fib_ws_alloc(ctx->ws, rec_limbs(d, cells) * sizeof(unsigned int));
+    if (!mem)
+        return -ENOMEM;
+    for (int i = 0; i < d; i++, mem += cells)
+        r[i] = mem;
+    for (int i = 0; i < REC_T_COUNT(d); i++, mem += tn)
+        t[i] = mem;
+    prod = mem;
+    scratch = prod + 2 * cells;
+
+    // r(x) = 1
+    for (int i = 0; i < d; i++)
+        memset(r[i], 0, cells * sizeof(unsigned int));
+    r[0][0] = 1;
+
+    for (int bit = fls64(k) - 1; bit >= 0; bit--) {
+        // t(x) = r(x)^2, products of the same pair of terms added twice
+        int len[REC_MAX_ORDER], w = 0;
+        for (int i = 0; i < d; i++) {
+            len[i] = rec_len(r[i], cells);
+            w = max(w, len[i]);
+        }
+        w = min(2 * w + d + 2, tn);
+        for (int i = 0; i < REC_T_COUNT(d); i++)
+            memset(t[i], 0, w * sizeof(unsigned int));
+
+        for (int i = 0; i < d; i++) {
+            if (!len[i])
+                continue;
+            if (fib_checkpoint(ctx))
+                return ctx->err;
+            limbs_sqr_n(prod, r[i], len[i], scratch);
+            limbs_add_at(t[2 * i], w, 0, prod, 2 * len[i]);
+
+            for (int j = i + 1; j < d; j++) {
+                if (!len[j])
+                    continue;
+                if (fib_checkpoint(ctx))
+                    return ctx->err;
+                int n = max(len[i], len[j]);
+                limbs_mul_n(prod, r[i], r[j], n, scratch);
+                limbs_add_at(t[i + j], w, 0, prod, 2 * n);
+                limbs_add_at(t[i + j], w, 0, prod, 2 * n);
+            }
+        }
+
+        // reduce with x^d = c[0] x^(d - 1) + ... + c[d - 1]
+        for (int m = REC_T_COUNT(d) - 1; m >= d; m--) {
+            for (int j = 0; j < d; j++)
+                limbs_addmul_1(t[m - 1 - j], t[m], w, coef[j]);
+        }
+        for (int i = 0; i < d; i++) {
+            memcpy(r[i], t[i], min(w, cells) * sizeof(unsigned int));
+            if (w < cells)
+                memset(r[i] + w, 0, (cells - w) * sizeof(unsigned int));
+        }
+
+        if (!(k >> bit & 1))
+            continue;
+
+        // r(x) = x r(x) mod P(x), the top term moves down to the constant
+        unsigned int *top = r[d - 1];
+        for (int i = d - 1; i > 0; i--) {
+            r[i] = r[i - 1];
+            limbs_addmul_1(r[i], top, cells, coef[d - 1 - i]);
+        }
+        limbs_mul_1(top, top, cells, coef[d - 1]);
+        r[0] = top;
+    }
+
+    // a(k) = r[0] a(0) + ... + r[d - 1] a(d - 1)
+    memset(out, 0, cells * sizeof(unsigned int));
+    for (int i = 0; i < d; i++)
+        limbs_addmul_1(out, r[i], cells, init[i]);
+    return 0;
+}
+
+#endif /* FIB_RECURRENCE_H */
@@ -1,6 +1,10 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
 static inline int estimate_size(long long k)
 {
     if (k <= 43)
@@ -41,6 +45,27 @@ static inline void destroy_ubig(ubig *ptr)
     }
 }
 
+/* bytes of workspace taken by new_ubig_ws(ws, size) */
+static inline size_t ubig_ws_bytes(int size)
+{
+    return FIB_WS_ALIGN(sizeof(ubig)) +
+           FIB_WS_ALIGN(size * sizeof(unsigned int));
+}
+
+/* like new_ubig(), but carved from a workspace instead of the allocator */
+static inline ubig *new_ubig_ws(struct fib_ws *ws, int size)
+{
+    ubig *ptr = fib_ws_alloc(ws, sizeof(ubig));
+    unsigned int *cellptr = fib_ws_alloc(ws, size * sizeof(unsigned int));
+    if (!ptr || !cellptr)
+        return NULL;
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
 static inline void zero_ubig(ubig *x)
 {
     memset(x->cell, 0, x->size * sizeof(unsigned int));
@@ -53,35 +78,28 @@ static inline void ubig_assign(ubig *dest, const ubig *src)
 
 static inline void ubig_add(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] + b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] += (dest->cell[i] < a->cell[i]);
+    limbs_add_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 static inline void ubig_sub(ubig *dest, ubig *a, ubig *b)
 {
-    for (int i = 0; i < a->size; i++)
-        dest->cell[i] = a->cell[i] - b->cell[i];
-
-    for (int i = 0; i < a->size - 1; i++)
-        dest->cell[i + 1] -= (dest->cell[i] > a->cell[i]);
+    limbs_sub_n(dest->cell, a->cell, b->cell, a->size);
 }
 
 static inline void ubig_lshift(ubig *dest, ubig *a, int x)
 {
-    zero_ubig(dest);
-
     // quotient and remainder of x being divided by 32
-    unsigned quotient = x >> 5, remainder = x & 0x1f;
-
-    for (int i = 0; i + quotient < a->size; i++)
-        dest->cell[i + quotient] |= a->cell[i] << remainder;
+    int quotient = x >> 5, remainder = x & 0x1f;
+    int n = min(a->size, dest->size - quotient);
+    if (n <= 0) {
+        zero_ubig(dest);
+        return;
+    }
 
-    if (remainder)
-        for (int i = 1; i + quotient < a->size; i++)
-            dest->cell[i + quotient] |= a->cell[i - 1] >> (32 - remainder);
+    limbs_lshift(dest->cell + quotient, a->cell, n, remainder);
+    memset(dest->cell, 0, quotient * sizeof(unsigned int));
+    memset(dest->cell + quotient + n, 0,
+           (dest->size - quotient - n) * sizeof(unsigned int));
 }
 
 static inline int ubig_msb_idx(const ubig *a)
@@ -92,7 +110,7 @@ static inline int ubig_msb_idx(const ubig *a)
     return msb_i;
 }
 
-void ubig_mul(ubig *dest, ubig *a, ubig *b)
+int ubig_mul(ubig *dest, ubig *a, ubig *b, struct fib_ctx *ctx)
 {
     zero_ubig(dest);
 
@@ -102,20 +120,25 @@ void ubig_mul(ubig *dest, ubig *a, ubig *b)
 
     // a == 0 or b == 0 then dest = 0
     if (msb_a < 0 || msb_b < 0)
-        return;
+        return 1;
 
-    // calculate the length of linear convolution vector
-    int length = msb_a + msb_b + 1;
+    // calculate the length of linear convolution vector, cells past dest
+    // are dropped
+    int length = min(msb_a + msb_b + 1, dest->size);
 
     /* do linear convolution */
     unsigned long long carry = 0ULL;
     for (int i = 0; i < length; i++) {
+        if (!(i & 0x3f) && fib_checkpoint(ctx))
+            return 0;
+
         unsigned long long row_sum = carry;
         carry = 0;
 
+        // a->cell[k] * b->cell[j] with j + k == i
         int end = (i <= msb_b) ? i : msb_b;
-        int start = i - end;
-        for (int j = start, k = end; j <= end; j++, k--) {
+        int start = (i <= msb_a) ? 0 : i - msb_a;
+        for (int j = start, k = i - start; j <= end; j++, k--) {
             unsigned long long product =
                 (unsigned long long) a->cell[k] * b->cell[j];
             row_sum += product;
@@ -125,60 +148,70 @@ void ubig_mul(ubig *dest, ubig *a, ubig *b)
         carry = (carry << 32) + (row_sum >> 32);
     }
 
-    dest->cell[length] = carry;
+    if (length < dest->size)
+        dest->cell[length] = carry;
+    return 1;
+}
+
+/* workspace needed by fib_sequence(k) */
+static inline size_t fib_ws_bytes(long long k)
+{
+    return 6 * ubig_ws_bytes(estimate_size(k));
 }
 
-static ubig *fib_sequence(long long k)
+static ubig *fib_sequence(long long k, ubig **next, struct fib_ctx *ctx)
 {
     if (k <= 1LL) {
-        ubig *result = new_ubig(1);
-        if (!result)
+        ubig *result = new_ubig_ws(ctx->ws, 1);
+        if (!result || (next && !(*next = new_ubig_ws(ctx->ws, 1))))
             return NULL;
+        if (next)
+            (*next)->cell[0] = 1U;
         result->cell[0] = (unsigned long long) k;
         return result;
     }
 
-    int sz = estimate_size(k);
-    ubig *a = new_ubig(sz);
-    ubig *b = new_ubig(sz);
-    ubig *tmp1 = new_ubig(sz);
-    ubig *tmp2 = new_ubig(sz);
-    ubig *t1 = new_ubig(sz);
-    ubig *t2 = new_ubig(sz);
-    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2) {
-        destroy_ubig(a);
-        destroy_ubig(b);
-        destroy_ubig(tmp1);
-        destroy_ubig(tmp2);
-        destroy_ubig(t1);
-        destroy_ubig(t2);
+    // F(k + 1) may take one more cell than F(k)
+    int sz = estimate_size(next ? k + 1 : k);
+    ubig *a = new_ubig_ws(ctx->ws, sz);
+    ubig *b = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp1 = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp2 = new_ubig_ws(ctx->ws, sz);
+    ubig *t1 = new_ubig_ws(ctx->ws, sz);
+    ubig *t2 = new_ubig_ws(ctx->ws, sz);
+    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2)
         return NULL;
-    }
     b->cell[0] = 1U;
 
+    int result = 1;
     for (unsigned long long mask = 0x8000000000000000ULL >> __builtin_clzll(k);
          mask; mask >>= 1) {
-        ubig_lshift(tmp1, b, 1);  // tmp1 = 2*b
-        ubig_sub(tmp2, tmp1, a);  // tmp2 = 2*b - a
-        ubig_mul(t1, a, tmp2);    // t1 = a*(2*b - a)
+        ubig_lshift(tmp1, b, 1);              // tmp1 = 2*b
+        ubig_sub(tmp2, tmp1, a);              // tmp2 = 2*b - a
+        result = ubig_mul(t1, a, tmp2, ctx);  // t1 = a*(2*b - a)
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp1, a, a, ctx);  // tmp1 = a^2
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp2, b, b, ctx);  // tmp2 = b^2
+        if (!result)
+            break;
 
-        ubig_mul(tmp1, a, a);      // tmp1 = a^2
-        ubig_mul(tmp2, b, b);      // tmp2 = b^2
         ubig_add(t2, tmp1, tmp2);  // t2 = a^2 + b^2
 
-        ubig_assign(a, t1);
-        ubig_assign(b, t2);
+        swap(a, t1);
+        swap(b, t2);
         if (k & mask) {
             ubig_add(t1, a, b);  // t1 = a + b
-            ubig_assign(a, b);
-            ubig_assign(b, t1);
+            swap(a, b);
+            swap(b, t1);
         }
     }
 
-    destroy_ubig(b);
-    destroy_ubig(tmp1);
-    destroy_ubig(tmp2);
-    destroy_ubig(t1);
-    destroy_ubig(t2);
-    return a;
+    if (result && next)
+        *next = b;
+    return result ? a : NULL;
 }
@@ -0,0 +1,226 @@
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "checkpoint.h"
+#include "limbs.h"
+#include "workspace.h"
+
+static inline int estimate_size(long long k)
+{
+    if (k <= 43)
+        return 1;
+    unsigned long long n = (k * 20899 - 34950) / 963305;
+    return (int) n + 1;
+}
+
+typedef struct BigN {
+    int size;
+    unsigned int *cell;
+} ubig;
+
+ubig *new_ubig(int size)
+{
+    ubig *ptr = kmalloc(sizeof(ubig), GFP_KERNEL);
+    if (!ptr)
+        return NULL;
+
+    unsigned int *cellptr = kmalloc(size * sizeof(unsigned int), GFP_KERNEL);
+    if (!cellptr) {
+        kfree(ptr);
+        return NULL;
+    }
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
+static inline void destroy_ubig(ubig *ptr)
+{
+    if (ptr) {
+        if (ptr->cell)
+            kfree(ptr->cell);
+        kfree(ptr);
+    }
+}
+
+/* bytes of workspace taken by new_ubig_ws(ws, size) */
+static inline size_t ubig_ws_bytes(int size)
+{
+    return FIB_WS_ALIGN(sizeof(ubig)) +
+           FIB_WS_ALIGN(size * sizeof(unsigned int));
+}
+
+/* like new_ubig(), but carved from a workspace instead of the allocator */
+static inline ubig *new_ubig_ws(struct fib_ws *ws, int size)
+{
+    ubig *ptr = fib_ws_alloc(ws, sizeof(ubig));
+    unsigned int *cellptr = fib_ws_alloc(ws, size * sizeof(unsigned int));
+    if (!ptr || !cellptr)
+        return NULL;
+    memset(cellptr, 0, size * sizeof(unsigned int));
+
+    ptr->size = size;
+    ptr->cell = cellptr;
+    return ptr;
+}
+
+static inline void zero_ubig(ubig *x)
+{
+    memset(x->cell, 0, x->size * sizeof(unsigned int));
+}
+
+// modify for dest, src having different size
+static inline void ubig_assign(ubig *dest, ubig *src)
+{
+    int sz = dest->size < src->size ? dest->size : src->size;
+    memset(dest->cell, 0, dest->size * sizeof(unsigned int));
+    memcpy(dest->cell, src->cell, sz * sizeof(unsigned int));
+}
+
+// a, b and dest have the same size
+static inline void ubig_add(ubig *dest, ubig *a, ubig *b)
+{
+    limbs_add_n(dest->cell, a->cell, b->cell, a->size);
+}
+
+// a, b and dest have the same size
+static inline void ubig_sub(ubig *dest, ubig *a, ubig *b)
+{
+    limbs_sub_n(dest->cell, a->cell, b->cell, a->size);
+}
+
+static inline void ubig_lshift(ubig *dest, ubig *a, int x)
+{
+    // quotient and remainder of x being divided by 32
+    int quotient = x >> 5, remainder = x & 0x1f;
+    int n = min(a->size, dest->size - quotient);
+    if (n <= 0) {
+        zero_ubig(dest);
+        return;
+    }
+
+    limbs_lshift(dest->cell + quotient, a->cell, n, remainder);
+    memset(dest->cell, 0, quotient * sizeof(unsigned int));
+    memset(dest->cell + quotient + n, 0,
+           (dest->size - quotient - n) * sizeof(unsigned int));
+}
+
+static inline int ubig_msb_idx(const ubig *a)
+{
+    int msb_i = a->size - 1;
+    while (msb_i >= 0 && !a->cell[msb_i])
+        msb_i--;
+    return msb_i;
+}
+
+/*
+ * dest = a * b, truncated to the size of dest. a and b have the same size.
+ * The product is formed by limbs_mul_n() or limbs_sqr_n() on the used
+ * limbs only, in a buffer and scratch area taken from the workspace.
+ */
+int ubig_mul(ubig *dest, ubig *a, ubig *b, struct fib_ctx *ctx)
+{
+    zero_ubig(dest);
+
+    int sz_a = ubig_msb_idx(a) + 1;
+    int sz_b = ubig_msb_idx(b) + 1;
+
+    // if a == 0 or b == 0 then dest = 0
+    if (sz_a == 0 || sz_b == 0)
+        return 1;
+
+    if (fib_checkpoint(ctx))
+        return 0;
+
+    int n = sz_a > sz_b ? sz_a : sz_b;
+    size_t mark = fib_ws_mark(ctx->ws);
+    unsigned int *prod = fib_ws_alloc(ctx->ws, 2 * n * sizeof(unsigned int));
+    unsigned int *scratch =
+        fib_ws_alloc(ctx->ws, limbs_mul_scratch(n) * sizeof(unsigned int));
+    if (!prod || !scratch) {
+        fib_ws_release(ctx->ws, mark);
+        return 0;
+    }
+
+    if (a == b)
+        limbs_sqr_n(prod, a->cell, n, scratch);
+    else
+        limbs_mul_n(prod, a->cell, b->cell, n, scratch);
+
+    int sz = dest->size < 2 * n ? dest->size : 2 * n;
+    memcpy(dest->cell, prod, sz * sizeof(unsigned int));
+    fib_ws_release(ctx->ws, mark);
+    return 1;
+}
+
+/*
+ * workspace needed by fib_sequence(k): six numbers plus the product buffer
+ * and scratch space of ubig_mul(), limbs_mul_scratch() does not decrease
+ * with the operand size
+ */
+static inline size_t fib_ws_bytes(long long k)
+{
+    int sz = estimate_size(k);
+    return 6 * ubig_ws_bytes(sz) +
+           FIB_WS_ALIGN(2 * sz * sizeof(unsigned int)) +
+           FIB_WS_ALIGN(limbs_mul_scratch(sz) * sizeof(unsigned int));
+}
+
+static ubig *fib_sequence(long long k, ubig **next, struct fib_ctx *ctx)
+{
+    if (k <= 1LL) {
+        ubig *result = new_ubig_ws(ctx->ws, 1);
+        if (!result || (next && !(*next = new_ubig_ws(ctx->ws, 1))))
+            return NULL;
+        if (next)
+            (*next)->cell[0] = 1U;
+        result->cell[0] = (unsigned long long) k;
+        return result;
+    }
+
+    // F(k + 1) may take one more cell than F(k)
+    int sz = estimate_size(next ? k + 1 : k);
+    ubig *a = new_ubig_ws(ctx->ws, sz);
+    ubig *b = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp1 = new_ubig_ws(ctx->ws, sz);
+    ubig *tmp2 = new_ubig_ws(ctx->ws, sz);
+    ubig *t1 = new_ubig_ws(ctx->ws, sz);
+    ubig *t2 = new_ubig_ws(ctx->ws, sz);
+    if (!a || !b || !tmp1 || !tmp2 || !t1 || !t2)
+        return NULL;
+    b->cell[0] = 1U;
+
+    int result = 1;
+    for (unsigned long long mask = 0x8000000000000000ULL >> __builtin_clzll(k);
+         mask; mask >>= 1) {
+        ubig_lshift(tmp1, b, 1);              // tmp1 = 2*b
+        ubig_sub(tmp2, tmp1, a);              // tmp2 = 2*b - a
+        result = ubig_mul(t1, a, tmp2, ctx);  // t1 = a*(2*b - a)
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp1, a, a, ctx);  // tmp1 = a^2
+        if (!result)
+            break;
+
+        result = ubig_mul(tmp2, b, b, ctx);  // tmp2 = b^2
+        if (!result)
+            break;
+
+        ubig_add(t2, tmp1, tmp2);  // t2 = a^2 + b^2
+
+        swap(a, t1);
+        swap(b, t2);
+        if (k & mask) {
+            ubig_add(t1, a, b);  // t1 = a + b
+            swap(a, b);
+            swap(b, t1);
+        }
+    }
+
+    if (result && next)
+        *next = b;
+    return result ? a : NULL;
+}
@@ -0,0 +1,157 @@
+#ifndef FIB_WORKSPACE_H
+#define FIB_WORKSPACE_H
+
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+/* idle workspaces older than this are given back to the allocator */
+#define FIB_WS_IDLE (10 * HZ)
+
+#define FIB_WS_ALIGN(x) ALIGN((x), sizeof(unsigned long))
+
+/**
+ * struct fib_ws - Scratch memory reused across computations.
+ * @list:      Entry in the idle list while nobody uses the workspace.
+ * @last_used: Jiffies when the workspace was last put back.
+ * @cap:       Size of @mem in bytes.
+ * @top:       Bytes of @mem handed out by fib_ws_alloc() so far.
+ * @mem:       The memory itself.
+ *
+ * Computations sleep in cond_resched() and GFP_KERNEL allocations, so a
+ * per-CPU buffer could not be held across one. Instead, idle workspaces
+ * sit in a global LIFO list: the most recently used, cache-hot one is
+ * handed out first, and it only grows when a larger k arrives.
+ */
+struct fib_ws {
+    struct list_head list;
+    unsigned long last_used;
+    size_t cap;
+    size_t top;
+    char *mem;
+};
+
+static LIST_HEAD(fib_ws_idle);
+static DEFINE_SPINLOCK(fib_ws_lock);
+
+static void fib_ws_trim(struct work_struct *work);
+static DECLARE_DELAYED_WORK(fib_ws_trim_work, fib_ws_trim);
+
+static void fib_ws_free(struct fib_ws *ws)
+{
+    kvfree(ws->mem);
+    kfree(ws);
+}
+
+/**
+ * fib_ws_get() - Take a workspace with at least @bytes bytes from the pool.
+ * @bytes: Required size, usually fib_ws_bytes() of the engine.
+ *
+ * Return: An empty workspace, or NULL if memory ran out.
+ */
+static struct fib_ws *fib_ws_get(size_t bytes)
+{
+    struct fib_ws *ws, *found = NULL;
+
+    spin_lock(&fib_ws_lock);
+    list_for_each_entry (ws, &fib_ws_idle, list) {
+        if (ws->cap >= bytes) {
+            found = ws;
+            break;
+        }
+    }
+    if (!found && !list_empty(&fib_ws_idle))
+        found = list_first_entry(&fib_ws_idle, struct fib_ws, list);
+    if (found)
+        list_del(&found->list);
+    spin_unlock(&fib_ws_lock);
+
+    if (!found) {
+        found = kzalloc(sizeof(*found), GFP_KERNEL);
+        if (!found)
+            return NULL;
+    }
+    if (found->cap < bytes) {
+        kvfree(found->mem);
+        found->cap = PAGE_ALIGN(bytes);
+        found->mem = kvmalloc(found->cap, GFP_KERNEL);
+        if (!found->mem) {
+            kfree(found);
+            return NULL;
+        }
+    }
+    found->top = 0;
+    return found;
+}
+
+/* give a workspace back to the pool, everything carved from it is gone */
+static void fib_ws_put(struct fib_ws *ws)
+{
+    if (!ws)
+        return;
+
+    ws->last_used = jiffies;
+    spin_lock(&fib_ws_lock);
+    list_add(&ws->list, &fib_ws_idle);
+    spin_unlock(&fib_ws_lock);
+    schedule_delayed_work(&fib_ws_trim_work, FIB_WS_IDLE);
+}
+
+/* carve @bytes bytes off the workspace, NULL if it is too small */
+static inline void *fib_ws_alloc(struct fib_ws *ws, size_t bytes)
+{
+    bytes = FIB_WS_ALIGN(bytes);
+    if (ws->cap - ws->top < bytes)
+        return NULL;
+
+    void *ptr = ws->mem + ws->top;
+    ws->top += bytes;
+    return ptr;
+}
+
+/* fib_ws_mark() and fib_ws_release() free scratch space in LIFO order */
+static inline size_t fib_ws_mark(const struct fib_ws *ws)
+{
+    return ws->top;
+}
+
+static inline void fib_ws_release(struct fib_ws *ws, size_t mark)
+{
+    ws->top = mark;
+}
+
+static void fib_ws_trim(struct work_struct *work)
+{
+    struct fib_ws *ws, *tmp;
+    LIST_HEAD(stale);
+
+    spin_lock(&fib_ws_lock);
+    list_for_each_entry_safe (ws, tmp, &fib_ws_idle, list) {
+        if (time_after(jiffies, ws->last_used + FIB_WS_IDLE))
+            list_move(&ws->list, &stale);
+    }
+    bool busy = !list_empty(&fib_ws_idle);
+    spin_unlock(&fib_ws_lock);
+
+    list_for_each_entry_safe (ws, tmp, &stale, list)
+        fib_ws_free(ws);
+    if (busy)
+        schedule_delayed_work(&fib_ws_trim_work, FIB_WS_IDLE);
+}
+
+/* release every pooled workspace, no computation may be running */
+static void fib_ws_exit(void)
+{
+    struct fib_ws *ws, *tmp;
+
+    cancel_delayed_work_sync(&fib_ws_trim_work);
+    list_for_each_entry_safe (ws, tmp, &fib_ws_idle, list)
+        fib_ws_free(ws);
+    INIT_LIST_HEAD(&fib_ws_idle);
+}
+
+#endif /* FIB_WORKSPACE_H */
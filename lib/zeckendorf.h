@@ -0,0 +1,277 @@
+#ifndef FIB_ZECKENDORF_H
+#define FIB_ZECKENDORF_H
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/overflow.h>
+
+/*
+ * Fibonacci coding of 64-bit integers. A value n >= 1 is written as its
+ * Zeckendorf representation, the coefficients of F(2), F(3), ... lowest
+ * first, followed by an extra 1. No representation has two adjacent ones,
+ * so the first "11" in a stream ends a codeword.
+ *
+ * Encoding is greedy over a table of F(k) down to small remainders, which
+ * come from a table of their own. Decoding goes a byte at a time:
+ * one table lookup finds where codewords end in the byte, and the data
+ * bits between those ends are valued with two more lookups, since
+ *
+ *   F(p + j + 2) = F(p + 1) F(j + 2) + F(p) F(j + 1)
+ *
+ * moves the value of bit j of a chunk to position p of its codeword.
+ */
+
+/* F(93) is the largest Fibonacci number of 64 bits */
+#define ZECK_FIBS 94
+
+/* data bits of the longest codeword, F(2)..F(93) */
+#define ZECK_MAX_DATA 92
+
+/* the longest codeword in bits, for 2^64 - 1 */
+#define ZECK_MAX_BITS (ZECK_MAX_DATA + 1)
+
+static u64 zeck_fib[ZECK_FIBS];
+
+/* for values of L bits, the largest k with F(k) below 2^L */
+static u8 zeck_top[65];
+
+/* Zeckendorf representations of the values below ZECK_SMALL */
+#define ZECK_SMALL 1024
+static u16 zeck_small[ZECK_SMALL];
+
+/* sum of F(j + 2) and of F(j + 1) over the bits j of a byte */
+static u32 zeck_a[256], zeck_b[256];
+
+/*
+ * where codewords end in a byte, indexed by whether the bit before it was a
+ * data 1: the number of ends in bits 0-2, their bit positions three bits
+ * each from bit 3 on, and in bit 15 whether the last bit is a data 1
+ */
+static u16 zeck_ends[2][256];
+
+#define ZECK_ENDS(e) ((e) & 7)
+#define ZECK_END(e, i) ((e) >> (3 + 3 * (i)) & 7)
+#define ZECK_CARRY(e) ((e) >> 15 & 1)
+
+static void zeck_init(void)
+{
+    zeck_fib[1] = 1;
+    for (int k = 2; k < ZECK_FIBS; k++)
+        zeck_fib[k] = zeck_fib[k - 1] + zeck_fib[k - 2];
+
+    for (int l = 1, k = 2; l <= 64; l++) {
+        u64 max = l == 64 ? U64_MAX : (1ULL << l) - 1;
+        while (k + 1 < ZECK_FIBS && zeck_fib[k + 1] <= max)
+            k++;
+        zeck_top[l] = k;
+    }
+
+    for (int n = 1; n < ZECK_SMALL; n++) {
+        for (int k = 16, x = n; x; k--) {
+            if (zeck_fib[k] <= x) {
+                zeck_small[n] |= 1 << (k - 2);
+                x -= zeck_fib[k];
+            }
+        }
+    }
+
+    for (int c = 0; c < 256; c++) {
+        for (int j = 0; j < 8; j++) {
+            if (c >> j & 1) {
+                zeck_a[c] += zeck_fib[j + 2];
+                zeck_b[c] += zeck_fib[j + 1];
+            }
+        }
+
+        for (int prev = 0; prev < 2; prev++) {
+            u16 e = 0;
+            for (int j = 0, p = prev; j < 8; j++) {
+                int bit = c >> j & 1;
+                if (bit && p) {
+                    e |= j << (3 + 3 * ZECK_ENDS(e));
+                    e++;
+                    p = 0;
+                } else {
+                    p = bit;
+                }
+                if (j == 7)
+                    e |= p << 15;
+            }
+            zeck_ends[prev][c] = e;
+        }
+    }
+}
+
+static inline void zeck_set_bit(u64 *lo, u64 *hi, int bit)
+{
+    if (bit < 64)
+        *lo |= 1ULL << bit;
+    else
+        *hi |= 1ULL << (bit - 64);
+}
+
+/**
+ * zeck_codeword() - The Fibonacci code of a value.
+ * @n:  Value to encode, at least 1.
+ * @lo: Receives bits 0..63 of the codeword.
+ * @hi: Receives the bits from 64 on.
+ *
+ * The greedy descent has no branch on the bits it picks, and it stops as
+ * soon as the rest of @n is in zeck_small[].
+ *
+ * Return: Length of the codeword in bits, 2..ZECK_MAX_BITS.
+ */
+static int zeck_codeword(u64 n, u64 *lo, u64 *hi)
+{
+    // F(k) <= n < F(k + 1) within two steps of the table
+    int k = zeck_top[fls64(n)];
+    k -= zeck_fib[k] > n;
+    k -= zeck_fib[k] > n;
+
+    // F(k) is bit k - 2, and the terminating 1 follows it
+    int len = k;
+    u64 l = 0, h = 0;
+    for (; k >= 66 && n >= ZECK_SMALL; k--) {
+        u64 take = n >= zeck_fib[k];
+        n -= zeck_fib[k] & -take;
+        h |= take << (k - 66);
+    }
+    for (; n >= ZECK_SMALL; k--) {
+        u64 take = n >= zeck_fib[k];
+        n -= zeck_fib[k] & -take;
+        l |= take << (k - 2);
+    }
+    *lo = l | zeck_small[n];
+    *hi = h;
+    zeck_set_bit(lo, hi, len - 1);
+    return len;
+}
+
+/**
+ * struct zeck_enc - Encoder state between codewords.
+ * @acc:  Bits not making up a whole byte yet, fewer than 8.
+ * @nacc: Number of bits in @acc.
+ */
+struct zeck_enc {
+    u64 acc;
+    int nacc;
+};
+
+/**
+ * zeck_put() - Append a codeword to a byte buffer.
+ * @e:   Encoder state.
+ * @p:   Where the next whole byte goes.
+ * @lo:  Bits 0..63 of the codeword.
+ * @hi:  The bits from 64 on.
+ * @len: Length of the codeword in bits.
+ *
+ * Return: Where the byte after the last whole one goes, at most
+ *         (@e->nacc + @len) / 8 bytes past @p.
+ */
+static inline u8 *zeck_put(struct zeck_enc *e, u8 *p, u64 lo, u64 hi, int len)
+{
+    while (len > 0) {
+        // at most 7 bits are waiting, so 56 more fit
+        int n = min(len, 56);
+        e->acc |= (lo & ((1ULL << n) - 1)) << e->nacc;
+        for (e->nacc += n; e->nacc >= 8; e->nacc -= 8) {
+            *p++ = e->acc;
+            e->acc >>= 8;
+        }
+        lo = lo >> n | hi << (64 - n);
+        hi >>= n;
+        len -= n;
+    }
+    return p;
+}
+
+/**
+ * struct zeck_dec - Decoder state between bits.
+ * @acc:  Value of the current codeword so far.
+ * @pos:  Data bits of the current codeword so far.
+ * @prev: Whether the last bit was a data 1, so a 1 next ends the codeword.
+ */
+struct zeck_dec {
+    u64 acc;
+    int pos;
+    bool prev;
+};
+
+/* add len data bits of a codeword, holding chunk, to d */
+static int zeck_dec_chunk(struct zeck_dec *d, unsigned int chunk, int len)
+{
+    u64 a, b;
+
+    if (d->pos + len > ZECK_MAX_DATA)
+        return -EINVAL;
+    if (check_mul_overflow(zeck_fib[d->pos + 1], (u64) zeck_a[chunk], &a) ||
+        check_mul_overflow(zeck_fib[d->pos], (u64) zeck_b[chunk], &b) ||
+        check_add_overflow(d->acc, a, &d->acc) ||
+        check_add_overflow(d->acc, b, &d->acc))
+        return -EINVAL;
+    d->pos += len;
+    return 0;
+}
+
+/**
+ * zeck_dec_bit() - Feed one bit to a decoder.
+ * @d:   Decoder state.
+ * @bit: The bit.
+ * @out: Receives the value when a codeword ends.
+ *
+ * Return: 1 if a codeword ended, 0 if not, -EINVAL if it is malformed.
+ */
+static int zeck_dec_bit(struct zeck_dec *d, int bit, u64 *out)
+{
+    if (bit && d->prev) {
+        *out = d->acc;
+        *d = (struct zeck_dec){0};
+        return 1;
+    }
+    d->prev = bit;
+    return zeck_dec_chunk(d, bit, 1);
+}
+
+/**
+ * zeck_dec_byte() - Feed eight bits to a decoder.
+ * @d:    Decoder state.
+ * @c:    The bits, bit 0 first.
+ * @out:  Receives the values of the codewords ending in @c, at most four.
+ * @max:  Number of values wanted at most, at least 1. Bits after the end of
+ *        the last of them are left alone.
+ * @end:  Receives the bit after the end of the last codeword stored.
+ *
+ * Return: Number of values stored, or -EINVAL if a codeword is malformed.
+ */
+static int zeck_dec_byte(struct zeck_dec *d,
+                         unsigned int c,
+                         u64 *out,
+                         int max,
+                         int *end)
+{
+    u16 e = zeck_ends[d->prev][c];
+    int n = 0, s = 0;
+
+    for (; n < ZECK_ENDS(e) && n < max; n++) {
+        // bits s..t - 1 are data, bit t is the terminating 1
+        int t = ZECK_END(e, n);
+        if (zeck_dec_chunk(d, c >> s & ((1U << (t - s)) - 1), t - s))
+            return -EINVAL;
+        out[n] = d->acc;
+        *d = (struct zeck_dec){0};
+        s = t + 1;
+    }
+    *end = s;
+    if (n < ZECK_ENDS(e))  // stopped at max
+        return n;
+
+    if (s < 8) {
+        if (zeck_dec_chunk(d, c >> s, 8 - s))
+            return -EINVAL;
+        d->prev = ZECK_CARRY(e);
+    }
+    return n;
+}
+
+#endif /* FIB_ZECKENDORF_H */
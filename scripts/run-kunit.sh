@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+
+# Load each KUnit module built in the given directory, print the KTAP
+# report it leaves in the kernel log, and fail if any case did not pass.
+
+KUNIT_DIR=${1:-tests}
+status=0
+
+sudo modprobe kunit 2>/dev/null
+for ko in "$KUNIT_DIR"/*_kunit.ko; do
+    name=$(basename "$ko" .ko)
+    sudo rmmod "$name" 2>/dev/null
+    start=$(sudo dmesg | wc -l)
+    if ! sudo insmod "$ko"; then
+        echo "$name: insmod failed"
+        status=1
+        continue
+    fi
+    report=$(sudo dmesg | tail -n +$((start + 1)))
+    sudo rmmod "$name"
+
+    echo "$report"
+    if ! echo "$report" | grep -q " ok [0-9]* fibdrv-" ||
+        echo "$report" | grep -q "not ok"; then
+        status=1
+    fi
+done
+exit $status
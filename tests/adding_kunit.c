@@ -0,0 +1,6 @@
+#include "../lib/adding.h"
+
+#define ENGINE_NAME "adding"
+#define ENGINE_FIB_MAX 50000  // quadratic in k, keep the suite quick
+
+#include "engine_kunit.h"
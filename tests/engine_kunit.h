@@ -0,0 +1,482 @@
+#ifndef FIB_ENGINE_KUNIT_H
+#define FIB_ENGINE_KUNIT_H
+
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+
+/*
+ * KUnit cases shared by the engine test modules. A module includes one
+ * engine from lib/, defines ENGINE_NAME, ENGINE_FIB_MAX (the largest k
+ * worth testing with that engine) and a flag per optional primitive,
+ * then includes this file:
+ *
+ *   ENGINE_HAS_SUB     ubig_sub()
+ *   ENGINE_HAS_LSHIFT  ubig_lshift()
+ *   ENGINE_HAS_MUL     ubig_mul()
+ *
+ * Primitives are checked against plain loops over the cells. fib_sequence()
+ * is checked against repeated addition for small k and, for any k, against
+ * F(k) modulo two primes found by modular fast doubling.
+ */
+
+/* operand sizes around cell, Karatsuba and Toom-3 boundaries */
+static const int engine_sizes[] = {1,   2,   3,   5,   31,  32,  33,
+                                   64,  127, 128, 129, 300, 1000};
+
+enum { FILL_RANDOM, FILL_ONES, FILL_ZERO, FILL_TOP_BIT, FILL_COUNT };
+
+static void engine_fill(unsigned int *x, int n, int fill)
+{
+    memset(x, fill == FILL_ONES ? 0xff : 0, n * sizeof(unsigned int));
+    if (fill == FILL_RANDOM)
+        get_random_bytes(x, n * sizeof(unsigned int));
+    else if (fill == FILL_TOP_BIT)
+        x[n - 1] = 0x80000000U;
+}
+
+static ubig *engine_ubig(struct kunit *test, int n)
+{
+    ubig *x = new_ubig(n);
+    KUNIT_ASSERT_NOT_NULL(test, x);
+    return x;
+}
+
+/* r = a + b mod 2^(32 n) */
+static void ref_add(unsigned int *r,
+                    const unsigned int *a,
+                    const unsigned int *b,
+                    int n)
+{
+    u64 carry = 0;
+    for (int i = 0; i < n; i++) {
+        carry += (u64) a[i] + b[i];
+        r[i] = carry;
+        carry >>= 32;
+    }
+}
+
+/* r = a << x mod 2^(32 n), one bit at a time */
+static void ref_lshift(unsigned int *r, const unsigned int *a, int n, int x)
+{
+    memset(r, 0, n * sizeof(unsigned int));
+    for (int i = 0; i + x < 32 * n; i++) {
+        if (a[i / 32] >> (i % 32) & 1)
+            r[(i + x) / 32] |= 1U << ((i + x) % 32);
+    }
+}
+
+/* r = a * b mod 2^(32 n) */
+static void ref_mul(unsigned int *r,
+                    const unsigned int *a,
+                    const unsigned int *b,
+                    int n)
+{
+    memset(r, 0, n * sizeof(unsigned int));
+    for (int i = 0; i < n; i++) {
+        u64 carry = 0;
+        for (int j = 0; i + j < n; j++) {
+            carry += (u64) a[i] * b[j] + r[i + j];
+            r[i + j] = carry;
+            carry >>= 32;
+        }
+    }
+}
+
+static u32 engine_mod(u64 x, u32 p)
+{
+    u32 rem;
+    div_u64_rem(x, p, &rem);
+    return rem;
+}
+
+/* F(k) mod p by fast doubling, independent of any engine */
+static u32 engine_fib_mod(u64 k, u32 p)
+{
+    u64 a = 0, b = 1;
+
+    for (int bit = fls64(k) - 1; bit >= 0; bit--) {
+        u64 c = engine_mod(a * engine_mod(2 * b + p - a, p), p);
+        u64 aa = engine_mod(a * a, p), bb = engine_mod(b * b, p);
+        u64 d = engine_mod(aa + bb, p);
+        a = k >> bit & 1 ? d : c;
+        b = k >> bit & 1 ? engine_mod(c + d, p) : d;
+    }
+    return a;
+}
+
+/* x mod p, highest cell first */
+static u32 engine_ubig_mod(const ubig *x, u32 p)
+{
+    u64 r = 0;
+    for (int i = x->size - 1; i >= 0; i--)
+        r = engine_mod(r << 32 | x->cell[i], p);
+    return r;
+}
+
+/* F(k) in a fresh workspace, valid until fib_ws_put(ctx->ws) */
+static ubig *engine_fib(struct kunit *test, long long k, struct fib_ctx *ctx)
+{
+    fib_ctx_init(ctx, 0, NULL);
+    ctx->ws = fib_ws_get(fib_ws_bytes(k));
+    KUNIT_ASSERT_NOT_NULL(test, ctx->ws);
+
+    ubig *fib = fib_sequence(k, NULL, ctx);
+    if (!fib)
+        fib_ws_put(ctx->ws);
+    KUNIT_ASSERT_NOT_NULL_MSG(test, fib, "F(%lld) failed with %d", k,
+                              ctx->err);
+    return fib;
+}
+
+static void engine_test_new(struct kunit *test)
+{
+    for (int s = 0; s < ARRAY_SIZE(engine_sizes); s++) {
+        int n = engine_sizes[s], nonzero = 0;
+        ubig *x = engine_ubig(test, n);
+        KUNIT_EXPECT_EQ(test, x->size, n);
+        for (int i = 0; i < n; i++)
+            nonzero += x->cell[i] != 0;
+        KUNIT_EXPECT_EQ(test, nonzero, 0);
+        destroy_ubig(x);
+    }
+}
+
+static void engine_test_add(struct kunit *test)
+{
+    for (int s = 0; s < ARRAY_SIZE(engine_sizes); s++) {
+        int n = engine_sizes[s];
+        ubig *a = engine_ubig(test, n), *b = engine_ubig(test, n);
+        ubig *d = engine_ubig(test, n);
+        unsigned int *ref = kunit_kcalloc(test, n, sizeof(*ref), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, ref);
+
+        for (int fa = 0; fa < FILL_COUNT; fa++) {
+            for (int fb = 0; fb < FILL_COUNT; fb++) {
+                engine_fill(a->cell, n, fa);
+                engine_fill(b->cell, n, fb);
+                ubig_add(d, a, b);
+                ref_add(ref, a->cell, b->cell, n);
+                KUNIT_EXPECT_EQ_MSG(test, memcmp(d->cell, ref, n * 4), 0,
+                                    "%d cells, fills %d + %d", n, fa, fb);
+            }
+        }
+        destroy_ubig(a);
+        destroy_ubig(b);
+        destroy_ubig(d);
+    }
+}
+
+#ifdef ENGINE_HAS_SUB
+static void engine_test_sub(struct kunit *test)
+{
+    for (int s = 0; s < ARRAY_SIZE(engine_sizes); s++) {
+        int n = engine_sizes[s];
+        ubig *a = engine_ubig(test, n), *b = engine_ubig(test, n);
+        ubig *c = engine_ubig(test, n), *d = engine_ubig(test, n);
+
+        // a = b + c without overflow, so a - b = c
+        for (int fb = 0; fb < FILL_COUNT; fb++) {
+            for (int fc = 0; fc < FILL_COUNT; fc++) {
+                engine_fill(b->cell, n, fb);
+                engine_fill(c->cell, n, fc);
+                b->cell[n - 1] >>= 1;
+                c->cell[n - 1] >>= 1;
+                ref_add(a->cell, b->cell, c->cell, n);
+                ubig_sub(d, a, b);
+                KUNIT_EXPECT_EQ_MSG(test, memcmp(d->cell, c->cell, n * 4), 0,
+                                    "%d cells, fills %d + %d", n, fb, fc);
+            }
+        }
+        destroy_ubig(a);
+        destroy_ubig(b);
+        destroy_ubig(c);
+        destroy_ubig(d);
+    }
+}
+#endif
+
+#ifdef ENGINE_HAS_LSHIFT
+static void engine_test_lshift(struct kunit *test)
+{
+    for (int s = 0; s < ARRAY_SIZE(engine_sizes); s++) {
+        int n = engine_sizes[s];
+        int shifts[] = {0, 1, 31, 32, 33, 63, 64, 32 * n - 1, 32 * n};
+        ubig *a = engine_ubig(test, n), *d = engine_ubig(test, n);
+        unsigned int *ref = kunit_kcalloc(test, n, sizeof(*ref), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, ref);
+
+        for (int f = 0; f < FILL_COUNT; f++) {
+            engine_fill(a->cell, n, f);
+            for (int i = 0; i < ARRAY_SIZE(shifts); i++) {
+                ubig_lshift(d, a, shifts[i]);
+                ref_lshift(ref, a->cell, n, shifts[i]);
+                KUNIT_EXPECT_EQ_MSG(test, memcmp(d->cell, ref, n * 4), 0,
+                                    "%d cells, fill %d, shift %d", n, f,
+                                    shifts[i]);
+            }
+        }
+        destroy_ubig(a);
+        destroy_ubig(d);
+    }
+}
+#endif
+
+#ifdef ENGINE_HAS_MUL
+/* a workspace large enough for ubig_mul() on n cells */
+static struct fib_ws *engine_mul_ws(struct kunit *test, int n)
+{
+    long long k = 64;
+    while (estimate_size(k) < n)
+        k *= 2;
+
+    struct fib_ws *ws = fib_ws_get(fib_ws_bytes(k));
+    KUNIT_ASSERT_NOT_NULL(test, ws);
+    return ws;
+}
+
+/*
+ * d = a * b mod 2^(32 n), a and b using la and lb of their n cells, b = a
+ * for squaring. A guard cell past d must survive.
+ */
+static void engine_check_mul(struct kunit *test,
+                             int n,
+                             int la,
+                             int lb,
+                             int fill,
+                             bool sqr)
+{
+    ubig *a = engine_ubig(test, n), *b = a;
+    ubig *d = engine_ubig(test, n + 1);
+    unsigned int *ref = kunit_kcalloc(test, n, sizeof(*ref), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+
+    engine_fill(a->cell, la, fill);
+    if (!sqr) {
+        b = engine_ubig(test, n);
+        engine_fill(b->cell, lb, fill == FILL_ONES ? FILL_ONES : FILL_RANDOM);
+    }
+    d->size = n;
+    d->cell[n] = 0xdeadbeef;
+
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, 0, NULL);
+    ctx.ws = engine_mul_ws(test, n);
+    KUNIT_EXPECT_NE(test, ubig_mul(d, a, b, &ctx), 0);
+    fib_ws_put(ctx.ws);
+
+    ref_mul(ref, a->cell, b->cell, n);
+    KUNIT_EXPECT_EQ_MSG(test, memcmp(d->cell, ref, n * 4), 0,
+                        "%d cells, %d x %d used, fill %d%s", n, la, lb, fill,
+                        sqr ? ", squared" : "");
+    KUNIT_EXPECT_EQ_MSG(test, d->cell[n], 0xdeadbeef,
+                        "%d cells, %d x %d used: wrote past dest", n, la, lb);
+
+    if (!sqr)
+        destroy_ubig(b);
+    destroy_ubig(a);
+    destroy_ubig(d);
+}
+
+static void engine_test_mul(struct kunit *test)
+{
+    for (int s = 0; s < ARRAY_SIZE(engine_sizes); s++) {
+        int n = engine_sizes[s], h = n / 2;
+        for (int f = 0; f < FILL_COUNT; f++) {
+            if (h)
+                engine_check_mul(test, n, h, n - h, f, false);
+            engine_check_mul(test, n, 1, max(n - 1, 1), f, false);
+            engine_check_mul(test, n, max(n - 1, 1), 1, f, false);
+            if (h)
+                engine_check_mul(test, n, h, h, f, true);
+        }
+        // one factor of 1 and the other filling every cell
+        ubig *a = engine_ubig(test, n), *d = engine_ubig(test, n + 1);
+        engine_fill(a->cell, n, FILL_RANDOM);
+        ubig *one = engine_ubig(test, n);
+        one->cell[0] = 1;
+        d->size = n;
+        d->cell[n] = 0xdeadbeef;
+
+        struct fib_ctx ctx;
+        fib_ctx_init(&ctx, 0, NULL);
+        ctx.ws = engine_mul_ws(test, n);
+        KUNIT_EXPECT_NE(test, ubig_mul(d, one, a, &ctx), 0);
+        fib_ws_put(ctx.ws);
+        KUNIT_EXPECT_EQ_MSG(test, memcmp(d->cell, a->cell, n * 4), 0,
+                            "%d cells, 1 x a", n);
+        KUNIT_EXPECT_EQ_MSG(test, d->cell[n], 0xdeadbeef,
+                            "%d cells, 1 x a: wrote past dest", n);
+        destroy_ubig(a);
+        destroy_ubig(one);
+        destroy_ubig(d);
+    }
+}
+#endif
+
+/* F(0)..F(1000) against repeated addition */
+static void engine_test_fib_small(struct kunit *test)
+{
+    int n = 24;  // F(1001) has 695 bits
+    unsigned int *prev = kunit_kcalloc(test, n, sizeof(*prev), GFP_KERNEL);
+    unsigned int *cur = kunit_kcalloc(test, n, sizeof(*cur), GFP_KERNEL);
+    unsigned int *next = kunit_kcalloc(test, n, sizeof(*next), GFP_KERNEL);
+    KUNIT_ASSERT_TRUE(test, prev && cur && next);
+    prev[0] = 1;  // F(-1)
+
+    for (int k = 0; k <= 1000; k++) {
+        struct fib_ctx ctx;
+        ubig *fib = engine_fib(test, k, &ctx);
+        int bad = 0;
+        for (int i = 0; i < max(fib->size, n); i++) {
+            unsigned int got = i < fib->size ? fib->cell[i] : 0;
+            bad += got != (i < n ? cur[i] : 0);
+        }
+        fib_ws_put(ctx.ws);
+        KUNIT_EXPECT_EQ_MSG(test, bad, 0, "F(%d)", k);
+
+        ref_add(next, prev, cur, n);
+        swap(prev, cur);
+        swap(cur, next);
+    }
+}
+
+/* F(k) modulo two primes for sizes up to ENGINE_FIB_MAX */
+static void engine_test_fib_mod(struct kunit *test)
+{
+    static const u32 primes[] = {4294967291U, 4294967279U};
+    long long ks[24] = {0,    1,    2,    46,    47,
+                        48,   93,   94,   1000,  4096,
+                        8191, 8192, 8193, ENGINE_FIB_MAX - 1, ENGINE_FIB_MAX};
+    for (int i = 15; i < ARRAY_SIZE(ks); i++)
+        ks[i] = get_random_u32() % (ENGINE_FIB_MAX + 1);
+
+    for (int i = 0; i < ARRAY_SIZE(ks); i++) {
+        struct fib_ctx ctx;
+        ubig *fib = engine_fib(test, ks[i], &ctx);
+        for (int p = 0; p < ARRAY_SIZE(primes); p++)
+            KUNIT_EXPECT_EQ_MSG(test, engine_ubig_mod(fib, primes[p]),
+                                engine_fib_mod(ks[i], primes[p]),
+                                "F(%lld) mod %u", ks[i], primes[p]);
+        fib_ws_put(ctx.ws);
+    }
+}
+
+/* F(k + 1) from the same run, also where it takes one more cell than F(k) */
+static void engine_test_fib_next(struct kunit *test)
+{
+    static const u32 p = 4294967291U;
+
+    for (long long k = 0; k <= ENGINE_FIB_MAX; k += k < 2000 ? 1 : k / 4) {
+        struct fib_ctx ctx;
+        fib_ctx_init(&ctx, 0, NULL);
+        ctx.ws = fib_ws_get(fib_ws_bytes(k + 1));
+        KUNIT_ASSERT_NOT_NULL(test, ctx.ws);
+
+        ubig *next, *fib = fib_sequence(k, &next, &ctx);
+        if (!fib)
+            fib_ws_put(ctx.ws);
+        KUNIT_ASSERT_NOT_NULL_MSG(test, fib, "F(%lld) failed with %d", k,
+                                  ctx.err);
+        KUNIT_EXPECT_EQ_MSG(test, engine_ubig_mod(fib, p),
+                            engine_fib_mod(k, p), "F(%lld)", k);
+        KUNIT_EXPECT_EQ_MSG(test, engine_ubig_mod(next, p),
+                            engine_fib_mod(k + 1, p), "F(%lld + 1)", k);
+        fib_ws_put(ctx.ws);
+    }
+}
+
+/* nanoseconds per call of each primitive, reported with kunit_info() */
+static void engine_test_bench(struct kunit *test)
+{
+    static const int sizes[] = {64, 512, 4096};
+
+    for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+        int n = sizes[s], reps = 65536 / n;
+        ubig *a = engine_ubig(test, n), *b = engine_ubig(test, n);
+        ubig *d = engine_ubig(test, n);
+        engine_fill(a->cell, n / 2, FILL_RANDOM);
+        engine_fill(b->cell, n / 2, FILL_RANDOM);
+
+        u64 t = ktime_get_ns();
+        for (int r = 0; r < reps; r++)
+            ubig_add(d, a, b);
+        kunit_info(test, "ubig_add %d cells: %llu ns\n", n,
+                   (ktime_get_ns() - t) / reps);
+#ifdef ENGINE_HAS_SUB
+        t = ktime_get_ns();
+        for (int r = 0; r < reps; r++)
+            ubig_sub(d, a, b);
+        kunit_info(test, "ubig_sub %d cells: %llu ns\n", n,
+                   (ktime_get_ns() - t) / reps);
+#endif
+#ifdef ENGINE_HAS_LSHIFT
+        t = ktime_get_ns();
+        for (int r = 0; r < reps; r++)
+            ubig_lshift(d, a, 33);
+        kunit_info(test, "ubig_lshift %d cells: %llu ns\n", n,
+                   (ktime_get_ns() - t) / reps);
+#endif
+#ifdef ENGINE_HAS_MUL
+        struct fib_ctx ctx;
+        fib_ctx_init(&ctx, 0, NULL);
+        ctx.ws = engine_mul_ws(test, n);
+        reps = max(4096 / n, 1);
+        t = ktime_get_ns();
+        for (int r = 0; r < reps; r++)
+            ubig_mul(d, a, b, &ctx);
+        kunit_info(test, "ubig_mul %d cells: %llu ns\n", n,
+                   (ktime_get_ns() - t) / reps);
+        fib_ws_put(ctx.ws);
+#endif
+        destroy_ubig(a);
+        destroy_ubig(b);
+        destroy_ubig(d);
+    }
+
+    for (long long k = 1000; k <= ENGINE_FIB_MAX; k *= 10) {
+        struct fib_ctx ctx;
+        u64 t = ktime_get_ns();
+        engine_fib(test, k, &ctx);
+        kunit_info(test, "fib_sequence(%lld): %llu ns\n", k,
+                   ktime_get_ns() - t);
+        fib_ws_put(ctx.ws);
+    }
+}
+
+static void engine_suite_exit(struct kunit_suite *suite)
+{
+    fib_ws_exit();
+}
+
+static struct kunit_case engine_test_cases[] = {
+    KUNIT_CASE(engine_test_new),
+    KUNIT_CASE(engine_test_add),
+#ifdef ENGINE_HAS_SUB
+    KUNIT_CASE(engine_test_sub),
+#endif
+#ifdef ENGINE_HAS_LSHIFT
+    KUNIT_CASE(engine_test_lshift),
+#endif
+#ifdef ENGINE_HAS_MUL
+    KUNIT_CASE(engine_test_mul),
+#endif
+    KUNIT_CASE(engine_test_fib_small),
+    KUNIT_CASE(engine_test_fib_mod),
+    KUNIT_CASE(engine_test_fib_next),
+    KUNIT_CASE(engine_test_bench),
+    {}
+};
+
+static struct kunit_suite engine_test_suite = {
+    .name = "fibdrv-" ENGINE_NAME,
+    .suite_exit = engine_suite_exit,
+    .test_cases = engine_test_cases,
+};
+
+kunit_test_suite(engine_test_suite);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("KUnit tests of the " ENGINE_NAME " engine");
+
+#endif /* FIB_ENGINE_KUNIT_H */
@@ -0,0 +1,9 @@
+#include "../lib/fast_doubling.h"
+
+#define ENGINE_NAME "fast-doubling"
+#define ENGINE_FIB_MAX 50000  // quadratic in k, keep the suite quick
+#define ENGINE_HAS_SUB
+#define ENGINE_HAS_LSHIFT
+#define ENGINE_HAS_MUL
+
+#include "engine_kunit.h"
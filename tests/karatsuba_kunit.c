@@ -0,0 +1,9 @@
+#include "../lib/karatsuba.h"
+
+#define ENGINE_NAME "karatsuba"
+#define ENGINE_FIB_MAX 188795
+#define ENGINE_HAS_SUB
+#define ENGINE_HAS_LSHIFT
+#define ENGINE_HAS_MUL
+
+#include "engine_kunit.h"
@@ -0,0 +1,327 @@
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+
+#include "../lib/toom_cook.h"
+#include "../lib/decimal.h"
+#include "../lib/digits.h"
+
+/*
+ * KUnit cases for the raw limb arithmetic: every level of limbs_mul_n()
+ * and dec_mul_n() against its schoolbook product, the base 10^9 engine
+ * against printing a binary F(k), and the digit queries against both.
+ */
+
+#define LIMBS_GUARD 0xdeadbeef
+
+/* operand sizes past the tested loops of 1..40 limbs */
+static const int limbs_sizes[] = {63, 64, 100, 127, 128, 129, 257, 600};
+
+/* the hierarchy forced onto each level in turn, then left at its default */
+static const struct {
+    int karatsuba, toom3;
+} limbs_levels[] = {
+    {INT_MAX, INT_MAX},
+    {KARATSUBA_MIN, INT_MAX},
+    {KARATSUBA_MIN, TOOM3_MIN},
+    {KARATSUBA_THRESHOLD, TOOM3_THRESHOLD},
+};
+
+/* n limbs, random or all ones, with a guard limb past them */
+static unsigned int *limbs_rand(struct kunit *test, int n, bool ones)
+{
+    unsigned int *x = kunit_kcalloc(test, n + 1, sizeof(*x), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, x);
+    if (ones)
+        memset(x, 0xff, n * sizeof(*x));
+    else
+        get_random_bytes(x, n * sizeof(*x));
+    x[n] = LIMBS_GUARD;
+    return x;
+}
+
+/* n base 10^9 limbs, random or all 999999999 */
+static unsigned int *dec_rand(struct kunit *test, int n, bool nines)
+{
+    unsigned int *x = kunit_kcalloc(test, n + 1, sizeof(*x), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, x);
+    for (int i = 0; i < n; i++)
+        x[i] = nines ? DEC_BASE - 1 : get_random_u32() % DEC_BASE;
+    x[n] = LIMBS_GUARD;
+    return x;
+}
+
+/* force level l of limbs_levels[] */
+static void limbs_set_level(int l)
+{
+    limbs_karatsuba_threshold = limbs_levels[l].karatsuba;
+    limbs_toom3_threshold = limbs_levels[l].toom3;
+}
+
+/* limbs_mul_n() and limbs_sqr_n() against limbs_mul_basecase() */
+static void limbs_check_mul(struct kunit *test, int n, bool ones)
+{
+    unsigned int *a = limbs_rand(test, n, ones);
+    unsigned int *b = limbs_rand(test, n, ones);
+    unsigned int *ref = limbs_rand(test, 2 * n, false);
+    unsigned int *r = limbs_rand(test, 2 * n, false);
+    int ns = limbs_mul_scratch(n);
+    unsigned int *scratch = limbs_rand(test, ns, false);
+
+    limbs_mul_basecase(ref, a, n, b, n);
+    limbs_mul_n(r, a, b, n, scratch);
+    KUNIT_EXPECT_EQ_MSG(test, memcmp(r, ref, 2 * n * sizeof(*r)), 0,
+                        "%d limbs, thresholds %d/%d", n,
+                        limbs_karatsuba_threshold, limbs_toom3_threshold);
+
+    limbs_mul_basecase(ref, a, n, a, n);
+    limbs_sqr_n(r, a, n, scratch);
+    KUNIT_EXPECT_EQ_MSG(test, memcmp(r, ref, 2 * n * sizeof(*r)), 0,
+                        "%d limbs squared, thresholds %d/%d", n,
+                        limbs_karatsuba_threshold, limbs_toom3_threshold);
+
+    KUNIT_EXPECT_EQ_MSG(test, r[2 * n], LIMBS_GUARD,
+                        "%d limbs: wrote past the product", n);
+    KUNIT_EXPECT_EQ_MSG(test, scratch[ns], LIMBS_GUARD,
+                        "%d limbs: wrote past limbs_mul_scratch()", n);
+    KUNIT_EXPECT_EQ(test, a[n], LIMBS_GUARD);
+    KUNIT_EXPECT_EQ(test, b[n], LIMBS_GUARD);
+}
+
+static void limbs_test_mul(struct kunit *test)
+{
+    int karatsuba = limbs_karatsuba_threshold, toom3 = limbs_toom3_threshold;
+
+    for (int l = 0; l < ARRAY_SIZE(limbs_levels); l++) {
+        limbs_set_level(l);
+        for (int n = 1; n <= 40; n++) {
+            limbs_check_mul(test, n, false);
+            limbs_check_mul(test, n, true);
+        }
+        for (int s = 0; s < ARRAY_SIZE(limbs_sizes); s++) {
+            limbs_check_mul(test, limbs_sizes[s], false);
+            limbs_check_mul(test, limbs_sizes[s], true);
+        }
+    }
+
+    limbs_karatsuba_threshold = karatsuba;
+    limbs_toom3_threshold = toom3;
+}
+
+/* dec_mul_n() against dec_mul_basecase() on both sides of Karatsuba */
+static void dec_test_mul(struct kunit *test)
+{
+    static const int sizes[] = {1,  2,  3,  23, 24, 25,
+                                47, 48, 49, 97, 200, 513};
+
+    for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+        for (int nines = 0; nines < 2; nines++) {
+            int n = sizes[s], ns = dec_mul_scratch(n);
+            unsigned int *a = dec_rand(test, n, nines);
+            unsigned int *b = dec_rand(test, n, nines);
+            unsigned int *ref = dec_rand(test, 2 * n, false);
+            unsigned int *r = dec_rand(test, 2 * n, false);
+            unsigned int *scratch = dec_rand(test, ns, false);
+
+            dec_mul_basecase(ref, a, n, b, n);
+            dec_mul_n(r, a, b, n, scratch);
+            KUNIT_EXPECT_EQ_MSG(test, memcmp(r, ref, 2 * n * sizeof(*r)), 0,
+                                "%d limbs", n);
+
+            dec_mul_basecase(ref, a, n, a, n);
+            dec_mul_n(r, a, a, n, scratch);
+            KUNIT_EXPECT_EQ_MSG(test, memcmp(r, ref, 2 * n * sizeof(*r)), 0,
+                                "%d limbs squared", n);
+
+            KUNIT_EXPECT_EQ_MSG(test, r[2 * n], LIMBS_GUARD,
+                                "%d limbs: wrote past the product", n);
+            KUNIT_EXPECT_EQ_MSG(test, scratch[ns], LIMBS_GUARD,
+                                "%d limbs: wrote past dec_mul_scratch()", n);
+        }
+    }
+}
+
+/* F(k) printed from the binary cells of the Toom-3 engine */
+static char *limbs_fib_str(struct kunit *test, long long k, size_t *len)
+{
+    struct fib_ctx ctx;
+    char *str = NULL;
+
+    fib_ctx_init(&ctx, 0, NULL);
+    ctx.ws = fib_ws_get(fib_ws_bytes(k));
+    KUNIT_ASSERT_NOT_NULL(test, ctx.ws);
+    ubig *fib = fib_sequence(k, NULL, &ctx);
+    if (fib) {
+        str = kunit_kzalloc(test, limbs_str_size(fib->size), GFP_KERNEL);
+        if (str)
+            *len = limbs_get_str(str, fib->cell, fib->size);
+    }
+    fib_ws_put(ctx.ws);
+    KUNIT_ASSERT_NOT_NULL_MSG(test, str, "F(%lld) failed", k);
+    return str;
+}
+
+/* the same through dec_fib() */
+static char *dec_fib_str(struct kunit *test, long long k, size_t *len)
+{
+    struct fib_ctx ctx;
+    char *str = NULL;
+    int n;
+
+    fib_ctx_init(&ctx, 0, NULL);
+    ctx.ws = fib_ws_get(dec_ws_bytes(k));
+    KUNIT_ASSERT_NOT_NULL(test, ctx.ws);
+    unsigned int *fib = dec_fib(k, &n, &ctx);
+    if (fib) {
+        str = kunit_kzalloc(test, dec_str_size(n), GFP_KERNEL);
+        if (str)
+            *len = dec_get_str(str, fib, n);
+    }
+    fib_ws_put(ctx.ws);
+    KUNIT_ASSERT_NOT_NULL_MSG(test, str, "F(%lld) failed", k);
+    return str;
+}
+
+static const long long limbs_ks[] = {0,    1,    2,    92,    93,    94,
+                                     1000, 4096, 8191, 10000, 65537, 188795};
+
+static void dec_test_fib(struct kunit *test)
+{
+    for (int k = 0; k <= 300; k++) {
+        size_t bin_len, dec_len;
+        char *bin = limbs_fib_str(test, k, &bin_len);
+        char *dec = dec_fib_str(test, k, &dec_len);
+        KUNIT_EXPECT_EQ_MSG(test, dec_len, bin_len, "F(%d)", k);
+        KUNIT_EXPECT_EQ_MSG(test, memcmp(dec, bin, min(dec_len, bin_len)), 0,
+                            "F(%d)", k);
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(limbs_ks); i++) {
+        size_t bin_len, dec_len;
+        char *bin = limbs_fib_str(test, limbs_ks[i], &bin_len);
+        char *dec = dec_fib_str(test, limbs_ks[i], &dec_len);
+        KUNIT_EXPECT_EQ_MSG(test, dec_len, bin_len, "F(%lld)", limbs_ks[i]);
+        KUNIT_EXPECT_EQ_MSG(test, memcmp(dec, bin, min(dec_len, bin_len)), 0,
+                            "F(%lld)", limbs_ks[i]);
+    }
+}
+
+/* fib_leading_digits() and fib_trailing_digits() against all digits */
+static void digits_test(struct kunit *test)
+{
+    static const int counts[] = {1, 9, 10, 19, DIG_MAX};
+
+    for (int i = 0; i < ARRAY_SIZE(limbs_ks); i++) {
+        size_t len;
+        char *all = dec_fib_str(test, limbs_ks[i], &len);
+
+        for (int c = 0; c < ARRAY_SIZE(counts); c++) {
+            char out[DIG_MAX], want[DIG_MAX];
+            int count = counts[c];
+            u64 length = 0;
+
+            int n = fib_leading_digits(out, count, limbs_ks[i], &length);
+            KUNIT_EXPECT_EQ_MSG(test, n, min_t(int, count, len),
+                                "F(%lld), %d leading", limbs_ks[i], count);
+            KUNIT_EXPECT_EQ(test, length, len);
+            if (n > 0)
+                KUNIT_EXPECT_EQ_MSG(test, memcmp(out, all, n), 0,
+                                    "F(%lld), %d leading", limbs_ks[i],
+                                    count);
+
+            // the last count digits, padded with zeros on the left
+            memset(want, '0', count);
+            int tail = min_t(int, count, len);
+            memcpy(want + count - tail, all + len - tail, tail);
+            KUNIT_EXPECT_EQ(test,
+                            fib_trailing_digits(out, count, limbs_ks[i]),
+                            count);
+            KUNIT_EXPECT_EQ_MSG(test, memcmp(out, want, count), 0,
+                                "F(%lld), %d trailing", limbs_ks[i], count);
+        }
+    }
+}
+
+/* nanoseconds per product at each level, reported with kunit_info() */
+static void limbs_test_bench(struct kunit *test)
+{
+    static const int sizes[] = {64, 512, 4096};
+    int karatsuba = limbs_karatsuba_threshold, toom3 = limbs_toom3_threshold;
+
+    for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+        int n = sizes[s], reps = max(65536 / n, 1);
+        size_t ns = dec_mul_scratch(n);
+        for (int l = 0; l < ARRAY_SIZE(limbs_levels); l++) {
+            limbs_set_level(l);
+            ns = max(ns, limbs_mul_scratch(n));
+        }
+
+        unsigned int *a = limbs_rand(test, n, false);
+        unsigned int *b = limbs_rand(test, n, false);
+        unsigned int *r = limbs_rand(test, 2 * n, false);
+        unsigned int *scratch = limbs_rand(test, ns, false);
+
+        for (int l = 0; l < ARRAY_SIZE(limbs_levels); l++) {
+            limbs_set_level(l);
+            u64 t = ktime_get_ns();
+            for (int i = 0; i < reps; i++)
+                limbs_mul_n(r, a, b, n, scratch);
+            u64 mul = (ktime_get_ns() - t) / reps;
+            t = ktime_get_ns();
+            for (int i = 0; i < reps; i++)
+                limbs_sqr_n(r, a, n, scratch);
+            kunit_info(test, "limbs_mul_n %d/%d %d limbs: %llu ns, sqr %llu\n",
+                       limbs_karatsuba_threshold, limbs_toom3_threshold, n,
+                       mul, (ktime_get_ns() - t) / reps);
+            cond_resched();
+        }
+        limbs_karatsuba_threshold = karatsuba;
+        limbs_toom3_threshold = toom3;
+
+        for (int i = 0; i < n; i++) {
+            a[i] %= DEC_BASE;
+            b[i] %= DEC_BASE;
+        }
+        u64 t = ktime_get_ns();
+        for (int i = 0; i < reps; i++)
+            dec_mul_n(r, a, b, n, scratch);
+        kunit_info(test, "dec_mul_n %d limbs: %llu ns\n", n,
+                   (ktime_get_ns() - t) / reps);
+    }
+
+    for (long long k = 1000; k <= 1000000; k *= 10) {
+        size_t len;
+        u64 t = ktime_get_ns();
+        limbs_fib_str(test, k, &len);
+        u64 bin = ktime_get_ns() - t;
+        t = ktime_get_ns();
+        dec_fib_str(test, k, &len);
+        kunit_info(test, "F(%lld) as decimal: %llu ns binary, %llu ns dec\n",
+                   k, bin, ktime_get_ns() - t);
+    }
+}
+
+static void limbs_suite_exit(struct kunit_suite *suite)
+{
+    fib_ws_exit();
+}
+
+static struct kunit_case limbs_test_cases[] = {
+    KUNIT_CASE(limbs_test_mul),
+    KUNIT_CASE(dec_test_mul),
+    KUNIT_CASE(dec_test_fib),
+    KUNIT_CASE(digits_test),
+    KUNIT_CASE(limbs_test_bench),
+    {}
+};
+
+static struct kunit_suite limbs_test_suite = {
+    .name = "fibdrv-limbs",
+    .suite_exit = limbs_suite_exit,
+    .test_cases = limbs_test_cases,
+};
+
+kunit_test_suite(limbs_test_suite);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("KUnit tests of the limb and base 10^9 arithmetic");
@@ -0,0 +1,9 @@
+#include "../lib/schonhange_strassen.h"
+
+#define ENGINE_NAME "schonhange-strassen"
+#define ENGINE_FIB_MAX 188795
+#define ENGINE_HAS_SUB
+#define ENGINE_HAS_LSHIFT
+#define ENGINE_HAS_MUL
+
+#include "engine_kunit.h"
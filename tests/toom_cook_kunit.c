@@ -0,0 +1,9 @@
+#include "../lib/toom_cook.h"
+
+#define ENGINE_NAME "toom-cook"
+#define ENGINE_FIB_MAX 188795
+#define ENGINE_HAS_SUB
+#define ENGINE_HAS_LSHIFT
+#define ENGINE_HAS_MUL
+
+#include "engine_kunit.h"
@@ -0,0 +1,256 @@
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#include "../lib/zeckendorf.h"
+
+/*
+ * KUnit cases for the Fibonacci codec: codewords against their definition,
+ * streams at every bit offset through the byte and the bit decoder, the
+ * malformed codewords the decoder has to refuse, and a benchmark.
+ */
+
+#define ZECK_VALUES 4096
+
+/* bit i of a stream */
+static int zeck_bit(const u8 *codes, u64 i)
+{
+    return codes[i / 8] >> i % 8 & 1;
+}
+
+/* a value of 1..64 random bits, at least 1 */
+static u64 zeck_rand(void)
+{
+    u64 v = get_random_u64() >> get_random_u32() % 64;
+    return v ? v : 1;
+}
+
+/* the codeword of n against its definition */
+static void zeck_check_codeword(struct kunit *test, u64 n)
+{
+    u64 lo, hi, sum = 0;
+    int len = zeck_codeword(n, &lo, &hi);
+    u8 codes[16];
+
+    KUNIT_ASSERT_TRUE(test, len >= 2 && len <= ZECK_MAX_BITS);
+    for (int i = 0; i < 8; i++) {
+        codes[i] = lo >> 8 * i;
+        codes[i + 8] = hi >> 8 * i;
+    }
+    for (int i = 0; i < len - 1; i++) {
+        int pair = zeck_bit(codes, i) & zeck_bit(codes, i + 1);
+        if (zeck_bit(codes, i))
+            sum += zeck_fib[i + 2];
+        // only the terminating 1 follows a 1
+        KUNIT_EXPECT_EQ_MSG(test, pair, i == len - 2, "%llu: bits %d and %d",
+                            n, i, i + 1);
+    }
+    KUNIT_EXPECT_EQ_MSG(test, sum, n, "%llu: sum of the codeword", n);
+    KUNIT_EXPECT_EQ_MSG(test, len < 64 ? lo >> len : 0, 0,
+                        "%llu: bits past the codeword", n);
+    KUNIT_EXPECT_EQ_MSG(test, len < 128 ? hi >> (len > 64 ? len - 64 : 0) : 0,
+                        0, "%llu: bits past the codeword", n);
+}
+
+static void zeck_test_codeword(struct kunit *test)
+{
+    for (u64 n = 1; n <= 4 * ZECK_SMALL; n++)
+        zeck_check_codeword(test, n);
+    for (int k = 2; k < ZECK_FIBS; k++) {
+        zeck_check_codeword(test, zeck_fib[k] - 1 ? zeck_fib[k] - 1 : 1);
+        zeck_check_codeword(test, zeck_fib[k]);
+        zeck_check_codeword(test, zeck_fib[k] + 1);
+    }
+    zeck_check_codeword(test, U64_MAX);
+    for (int i = 0; i < 100000; i++)
+        zeck_check_codeword(test, zeck_rand());
+}
+
+/* ZECK_VALUES random values coded from bit start on, returns the end */
+static u64 zeck_fill(struct kunit *test, u64 *v, u8 *codes, int start)
+{
+    struct zeck_enc e = {.nacc = start};
+    u8 *p = codes;
+    u64 bit = start;
+
+    for (int i = 0; i < ZECK_VALUES; i++) {
+        u64 lo, hi;
+        v[i] = i < ZECK_FIBS ? max(zeck_fib[i], 1ULL) : zeck_rand();
+        if (i == ZECK_FIBS)
+            v[i] = U64_MAX;
+        int len = zeck_codeword(v[i], &lo, &hi);
+        p = zeck_put(&e, p, lo, hi, len);
+        bit += len;
+    }
+    if (e.nacc)
+        *p++ = e.acc;
+    KUNIT_EXPECT_EQ(test, p - codes, (bit + 7) / 8);
+    return bit;
+}
+
+static void zeck_test_stream(struct kunit *test)
+{
+    size_t size = ZECK_VALUES * (ZECK_MAX_BITS / 8 + 1) + 1;
+    u64 *v = kunit_kcalloc(test, ZECK_VALUES, sizeof(*v), GFP_KERNEL);
+    u64 *out = kunit_kcalloc(test, ZECK_VALUES + 4, sizeof(*out), GFP_KERNEL);
+    u8 *codes = kunit_kcalloc(test, size, 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, v);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    KUNIT_ASSERT_NOT_NULL(test, codes);
+
+    for (int start = 0; start < 8; start++) {
+        u64 end = zeck_fill(test, v, codes, start), bit, last = 0;
+        struct zeck_dec d = {0};
+        int n = 0;
+
+        // bit by bit up to a byte boundary, then bytes, then bits again
+        for (bit = start; bit % 8; bit++)
+            n += zeck_dec_bit(&d, zeck_bit(codes, bit), out + n);
+        for (; bit + 8 <= end; bit += 8) {
+            int e, r = zeck_dec_byte(&d, codes[bit / 8], out + n, 4, &e);
+            KUNIT_ASSERT_TRUE(test, r >= 0);
+            if (r)
+                last = bit + e;
+            n += r;
+        }
+        for (; bit < end; bit++) {
+            int r = zeck_dec_bit(&d, zeck_bit(codes, bit), out + n);
+            KUNIT_ASSERT_TRUE(test, r >= 0);
+            if (r)
+                last = bit + 1;
+            n += r;
+        }
+        KUNIT_EXPECT_EQ_MSG(test, n, ZECK_VALUES, "from bit %d", start);
+        KUNIT_EXPECT_EQ_MSG(test, last, end, "from bit %d", start);
+        KUNIT_EXPECT_EQ_MSG(test, memcmp(out, v, ZECK_VALUES * sizeof(*v)), 0,
+                            "from bit %d", start);
+
+        // stopping at every count
+        memset(&d, 0, sizeof(d));
+        int next = 0;
+        for (bit = start; bit % 8; bit++)
+            next += zeck_dec_bit(&d, zeck_bit(codes, bit), out);
+        for (int i = 0; i < 8 && bit + 8 <= end; i++, bit += 8) {
+            for (int max = 1; max <= 4; max++) {
+                struct zeck_dec c = d;
+                int e, r = zeck_dec_byte(&c, codes[bit / 8], out, max, &e);
+                KUNIT_EXPECT_TRUE(test, r >= 0 && r <= max);
+                for (int j = 0; j < r; j++)
+                    KUNIT_EXPECT_EQ(test, out[j], v[next + j]);
+            }
+            int e;
+            next += zeck_dec_byte(&d, codes[bit / 8], out, 4, &e);
+        }
+    }
+}
+
+/* a codeword with data bits at the given positions */
+static int zeck_decode_bits(const int *ones, int n, int len, u64 *out)
+{
+    struct zeck_dec d = {0};
+    u8 codes[16] = {0};
+    int r = 0;
+
+    for (int i = 0; i < n; i++)
+        codes[ones[i] / 8] |= 1 << ones[i] % 8;
+    codes[(len - 1) / 8] |= 1 << (len - 1) % 8;
+    for (int i = 0; i < (len + 7) / 8 && !r; i++) {
+        int e;
+        r = zeck_dec_byte(&d, codes[i], out, 1, &e);
+    }
+    return r;
+}
+
+static void zeck_test_malformed(struct kunit *test)
+{
+    u64 v;
+
+    // F(93), the largest value of a single term
+    KUNIT_EXPECT_EQ(test, zeck_decode_bits((int[]){91}, 1, 93, &v), 1);
+    KUNIT_EXPECT_EQ(test, v, zeck_fib[93]);
+
+    // F(94) needs 93 data bits
+    KUNIT_EXPECT_EQ(test, zeck_decode_bits((int[]){92}, 1, 94, &v), -EINVAL);
+
+    // F(93) + F(91) + F(89) exceeds 64 bits
+    KUNIT_EXPECT_EQ(test, zeck_decode_bits((int[]){87, 89, 91}, 3, 93, &v),
+                    -EINVAL);
+
+    // the same through the bit decoder
+    struct zeck_dec d = {0};
+    int r = 0;
+    for (int i = 0; i < 94 && !r; i++)
+        r = zeck_dec_bit(&d, i == 92 || i == 93, &v);
+    KUNIT_EXPECT_EQ(test, r, -EINVAL);
+}
+
+/* values per second of either direction, reported with kunit_info() */
+static void zeck_test_bench(struct kunit *test)
+{
+    size_t size = ZECK_VALUES * (ZECK_MAX_BITS / 8 + 1) + 1;
+    u64 *v = kunit_kcalloc(test, ZECK_VALUES, sizeof(*v), GFP_KERNEL);
+    u64 *out = kunit_kcalloc(test, ZECK_VALUES + 4, sizeof(*out), GFP_KERNEL);
+    u8 *codes = kunit_kcalloc(test, size, 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, v);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    KUNIT_ASSERT_NOT_NULL(test, codes);
+
+    for (int bits = 8; bits <= 64; bits += 56) {
+        for (int i = 0; i < ZECK_VALUES; i++) {
+            v[i] = get_random_u64() >> (64 - bits);
+            v[i] = v[i] ? v[i] : 1;
+        }
+
+        struct zeck_enc e = {0};
+        u8 *p = codes;
+        u64 t = ktime_get_ns();
+        for (int i = 0; i < ZECK_VALUES; i++) {
+            u64 lo, hi;
+            int len = zeck_codeword(v[i], &lo, &hi);
+            p = zeck_put(&e, p, lo, hi, len);
+        }
+        if (e.nacc)
+            *p++ = e.acc;
+        u64 enc = ktime_get_ns() - t;
+
+        struct zeck_dec d = {0};
+        int n = 0;
+        t = ktime_get_ns();
+        for (u8 *c = codes; c < p; c++) {
+            int end;
+            n += zeck_dec_byte(&d, *c, out + n, 4, &end);
+        }
+        u64 dec = ktime_get_ns() - t;
+        KUNIT_EXPECT_EQ(test, n, ZECK_VALUES);
+
+        kunit_info(test, "%d-bit values: encode %llu/s, decode %llu/s\n",
+                   bits, ZECK_VALUES * NSEC_PER_SEC / max(enc, 1ULL),
+                   ZECK_VALUES * NSEC_PER_SEC / max(dec, 1ULL));
+    }
+}
+
+static int zeck_suite_init(struct kunit_suite *suite)
+{
+    zeck_init();
+    return 0;
+}
+
+static struct kunit_case zeck_test_cases[] = {
+    KUNIT_CASE(zeck_test_codeword),
+    KUNIT_CASE(zeck_test_stream),
+    KUNIT_CASE(zeck_test_malformed),
+    KUNIT_CASE(zeck_test_bench),
+    {}
+};
+
+static struct kunit_suite zeck_test_suite = {
+    .name = "fibdrv-zeckendorf",
+    .suite_init = zeck_suite_init,
+    .test_cases = zeck_test_cases,
+};
+
+kunit_test_suite(zeck_test_suite);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("KUnit tests of the Fibonacci codec");